@@ -1,19 +1,30 @@
 // directory.cc
 //	Routines to manage a directory of file names.
 //
-//	The directory is a table of fixed length entries; each
+//	The directory is a hash table of fixed length entries; each
 //	entry represents a single file, and contains the file name,
 //	and the location of the file header on disk.  The fixed size
 //	of each directory entry means that we have the restriction
 //	of a fixed maximum size for file names.
 //
-//	The constructor initializes an empty directory of a certain size;
-//	we use ReadFrom/WriteBack to fetch the contents of the directory
-//	from disk, and to write back any modifications back to disk.
+//	The entries live in bucket sectors, found through a table of
+//	pointers indexed by the low "depth" bits of the name's hash
+//	(extendible hashing).  Several pointers can share a bucket; a
+//	bucket's "localDepth" says how many bits its names have in
+//	common.  When a bucket is full, it is split on the next bit, and
+//	if it already used every bit of the table, the table doubles
+//	first.  Buckets are never merged again, so a directory does not
+//	shrink when files are removed.
 //
-//	Also, this implementation has the restriction that the size
-//	of the directory cannot expand.  In other words, once all the
-//	entries in the directory are used, no more files can be created.
+//	The directory file is laid out as:
+//	   sector 0: header fields, and the pointer table while it has
+//		no more than InlinePointers entries
+//	   other sectors: buckets, the pointer table once it is larger
+//		(in consecutive sectors), and unused sectors on a free list
+//
+//	The constructor initializes an empty directory;
+//	we use FetchFrom to read the header from disk.  Add and Remove
+//	write the sectors they change straight back to disk.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -23,30 +34,28 @@
 #include "utility.h"
 #include "filehdr.h"
 #include "directory.h"
+#include "main.h"
 
-#define NumDirEntries 10
 //----------------------------------------------------------------------
 // Directory::Directory
 // 	Initialize a directory; initially, the directory is completely
-//	empty.  If the disk is being formatted, an empty directory
-//	is all we need, but otherwise, we need to call FetchFrom in order
-//	to initialize it from disk.
-//
-//	"size" is the number of entries in the directory
+//	empty: one empty bucket, that every name hashes to.  If the disk
+//	is being formatted, an empty directory is all we need, but
+//	otherwise, we need to call FetchFrom in order to initialize it
+//	from disk.
 //----------------------------------------------------------------------
 
-Directory::Directory(int size)
+Directory::Directory()
 {
-    table = new DirectoryEntry[size];
-
-    // MP4 mod tag
-    memset(table, 0, sizeof(DirectoryEntry) * size); // dummy operation to keep valgrind happy
-
-    tableSize = size;
-    for (int i = 0; i < tableSize; i++){
-        table[i].inUse = FALSE;
-        table[i].isDir = -1;
-    }
+    numEntries = 0;
+    depth = 0;
+    numBlocks = 2; // the header, and the first bucket
+    tableBlock = -1;
+    freeBlock = -1;
+    memset(inlineTable, 0, sizeof(inlineTable)); // keep valgrind happy
+    inlineTable[0] = 1;
+    file = NULL;
+    fresh = TRUE;
 }
 
 //----------------------------------------------------------------------
@@ -56,45 +65,295 @@ Directory::Directory(int size)
 
 Directory::~Directory()
 {
-    delete[] table;
 }
 
 //----------------------------------------------------------------------
 // Directory::FetchFrom
-// 	Read the contents of the directory from disk.
+// 	Read the header of the directory from disk.  The buckets stay
+//	on disk, and are read as they are needed.
 //
 //	"file" -- file containing the directory contents
 //----------------------------------------------------------------------
 
 void Directory::FetchFrom(OpenFile *file)
 {
-    (void)file->ReadAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
+    int header[SectorSize / sizeof(int)];
+
+    (void)file->ReadAt((char *)header, SectorSize, 0);
+    numEntries = header[0];
+    depth = header[1];
+    numBlocks = header[2];
+    tableBlock = header[3];
+    freeBlock = header[4];
+    memcpy(inlineTable, &header[DirHeaderFields], sizeof(inlineTable));
+    this->file = file;
+    fresh = FALSE;
 }
 
 //----------------------------------------------------------------------
 // Directory::WriteBack
-// 	Write any modifications to the directory back to disk
+// 	Write any modifications to the directory back to disk.  Add and
+//	Remove have already written the buckets they changed, so only
+//	the header is left -- except for a new directory, whose first
+//	bucket is written here too.
 //
 //	"file" -- file to contain the new directory contents
 //----------------------------------------------------------------------
 
 void Directory::WriteBack(OpenFile *file)
 {
-    (void)file->WriteAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
+    this->file = file;
+    if (fresh)
+    {
+        DirectoryBucket empty;
+
+        memset(&empty, 0, sizeof(empty));
+        WriteBlock(inlineTable[0], &empty);
+        fresh = FALSE;
+    }
+    WriteHeader();
+}
+
+//----------------------------------------------------------------------
+// Directory::WriteHeader
+// 	Store the header fields, and the small pointer table, into the
+//	first sector of the directory file.
+//----------------------------------------------------------------------
+
+void Directory::WriteHeader()
+{
+    int header[SectorSize / sizeof(int)];
+
+    memset(header, 0, SectorSize);
+    header[0] = numEntries;
+    header[1] = depth;
+    header[2] = numBlocks;
+    header[3] = tableBlock;
+    header[4] = freeBlock;
+    memcpy(&header[DirHeaderFields], inlineTable, sizeof(inlineTable));
+    (void)file->WriteAt((char *)header, SectorSize, 0);
+}
+
+//----------------------------------------------------------------------
+// Directory::Hash
+// 	Hash a file name (FNV-1a).  Only the part of the name that is
+//	stored in a directory entry counts.
+//
+//	"name" -- the file name to hash
+//----------------------------------------------------------------------
+
+unsigned Directory::Hash(char *name)
+{
+    unsigned hash = 2166136261u;
+
+    for (int i = 0; i < FileNameMaxLen && name[i] != '\0'; i++)
+    {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+//----------------------------------------------------------------------
+// Directory::GetPointer
+// 	Return the sector of the directory file holding the bucket that
+//	pointer "index" refers to.
+//----------------------------------------------------------------------
+
+int Directory::GetPointer(int index)
+{
+    int block;
+
+    ASSERT(index >= 0 && index < (1 << depth));
+    if (tableBlock < 0)
+        return inlineTable[index];
+    (void)file->ReadAt((char *)&block, sizeof(int),
+                       tableBlock * SectorSize + index * sizeof(int));
+    return block;
+}
+
+//----------------------------------------------------------------------
+// Directory::SetPointer
+// 	Make pointer "index" refer to the bucket in sector "block".
+//----------------------------------------------------------------------
+
+void Directory::SetPointer(int index, int block)
+{
+    ASSERT(index >= 0 && index < (1 << depth));
+    if (tableBlock < 0)
+        inlineTable[index] = block;
+    else
+        (void)file->WriteAt((char *)&block, sizeof(int),
+                            tableBlock * SectorSize + index * sizeof(int));
+}
+
+//----------------------------------------------------------------------
+// Directory::ReadBlock / Directory::WriteBlock
+// 	Move one bucket between memory and sector "block" of the
+//	directory file.
+//----------------------------------------------------------------------
+
+void Directory::ReadBlock(int block, DirectoryBucket *bucket)
+{
+    (void)file->ReadAt((char *)bucket, SectorSize, block * SectorSize);
+}
+
+void Directory::WriteBlock(int block, DirectoryBucket *bucket)
+{
+    (void)file->WriteAt((char *)bucket, SectorSize, block * SectorSize);
+}
+
+//----------------------------------------------------------------------
+// Directory::AppendBlocks
+// 	Take "count" more sectors at the end of the directory file,
+//	making the file longer if it has to.  The file grows by a quarter
+//	of its size at a time, so that a growing directory does not
+//	extend its header on every split.  Return the first new sector,
+//	or -1 if the disk is full.
+//----------------------------------------------------------------------
+
+int Directory::AppendBlocks(int count, PersistentBitmap *freeMap)
+{
+    int first = numBlocks;
+    int needed = (numBlocks + count) * SectorSize;
+
+    if (needed > file->Length() &&
+        !file->Extend(freeMap, max(needed, numBlocks * SectorSize * 5 / 4)))
+        return -1;
+    numBlocks += count;
+    return first;
+}
+
+//----------------------------------------------------------------------
+// Directory::NewBlock
+// 	Find a sector of the directory file for a new bucket: one from
+//	the free list if there is any, otherwise a new one at the end.
+//----------------------------------------------------------------------
+
+int Directory::NewBlock(PersistentBitmap *freeMap)
+{
+    int block = freeBlock;
+
+    if (block < 0)
+        return AppendBlocks(1, freeMap);
+    (void)file->ReadAt((char *)&freeBlock, sizeof(int), block * SectorSize);
+    return block;
+}
+
+//----------------------------------------------------------------------
+// Directory::FreeBlock
+// 	Put an unused sector of the directory file on the free list.
+//	Its first word links to the next one.
+//----------------------------------------------------------------------
+
+void Directory::FreeBlock(int block)
+{
+    (void)file->WriteAt((char *)&freeBlock, sizeof(int), block * SectorSize);
+    freeBlock = block;
+}
+
+//----------------------------------------------------------------------
+// Directory::DoubleTable
+// 	Use one more bit of the hash: double the pointer table, with
+//	both halves pointing at the same buckets.  A table too big for
+//	the header moves to new sectors at the end of the file; the
+//	sectors of the old one go on the free list.  Return FALSE if the
+//	disk is full.
+//----------------------------------------------------------------------
+
+bool Directory::DoubleTable(PersistentBitmap *freeMap)
+{
+    int oldSize = 1 << depth;
+    int newSize = 2 * oldSize;
+    int *table, first;
+
+    if (newSize <= InlinePointers)
+    {
+        memcpy(&inlineTable[oldSize], inlineTable, oldSize * sizeof(int));
+        depth++;
+        return TRUE;
+    }
+
+    first = AppendBlocks(newSize / PointersPerSector, freeMap);
+    if (first < 0)
+        return FALSE;
+    table = new int[newSize];
+    if (tableBlock < 0)
+        memcpy(table, inlineTable, oldSize * sizeof(int));
+    else
+        (void)file->ReadAt((char *)table, oldSize * sizeof(int),
+                           tableBlock * SectorSize);
+    memcpy(&table[oldSize], table, oldSize * sizeof(int));
+    (void)file->WriteAt((char *)table, newSize * sizeof(int),
+                        first * SectorSize);
+    delete[] table;
+
+    if (tableBlock >= 0)
+        for (int i = 0; i < oldSize / (int)PointersPerSector; i++)
+            FreeBlock(tableBlock + i);
+    tableBlock = first;
+    depth++;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Directory::Split
+// 	Split the full bucket "bucket" (at sector "block", reached through
+//	pointer "index") on the next bit of the hash: names with that bit
+//	set move to a new bucket, and the pointers that should now lead
+//	there are changed.  Return FALSE if the disk is full or the
+//	hash has no bits left.
+//----------------------------------------------------------------------
+
+bool Directory::Split(int index, int block, DirectoryBucket *bucket,
+                      PersistentBitmap *freeMap)
+{
+    DirectoryBucket sibling;
+    int bit = 1 << bucket->localDepth;
+    int newBlock;
+
+    if (bucket->localDepth == depth &&
+        (depth == MaxDirDepth || !DoubleTable(freeMap)))
+        return FALSE;
+    newBlock = NewBlock(freeMap);
+    if (newBlock < 0)
+        return FALSE;
+
+    memset(&sibling, 0, sizeof(sibling));
+    bucket->localDepth++;
+    sibling.localDepth = bucket->localDepth;
+    for (int i = 0; i < bucket->count;)
+    {
+        if (Hash(bucket->entries[i].name) & bit)
+        {
+            sibling.entries[sibling.count++] = bucket->entries[i];
+            bucket->entries[i] = bucket->entries[--bucket->count];
+        }
+        else
+            i++;
+    }
+    WriteBlock(block, bucket);
+    WriteBlock(newBlock, &sibling);
+
+    // 後面那半的 pointer 都改指到新的 bucket
+    for (int i = (index & (bit - 1)) | bit; i < (1 << depth); i += 2 * bit)
+        SetPointer(i, newBlock);
+    return TRUE;
 }
 
 //----------------------------------------------------------------------
 // Directory::FindIndex
-// 	Look up file name in directory, and return its location in the table of
-//	directory entries.  Return -1 if the name isn't in the directory.
+// 	Look up file name in a bucket, and return its location in the
+//	bucket's entries.  Return -1 if the name isn't there.
 //
+//	"bucket" -- the bucket the name hashes to
 //	"name" -- the file name to look up
 //----------------------------------------------------------------------
 
-int Directory::FindIndex(char *name)
+int Directory::FindIndex(DirectoryBucket *bucket, char *name)
 {
-    for (int i = 0; i < tableSize; i++) {
-        if (table[i].inUse && !strncmp(table[i].name, name, FileNameMaxLen))
+    for (int i = 0; i < bucket->count; i++) {
+        if (!strncmp(bucket->entries[i].name, name, FileNameMaxLen))
             return i;
     }
         
@@ -105,17 +364,22 @@ int Directory::FindIndex(char *name)
 // Directory::Find
 // 	Look up file name in directory, and return the disk sector number
 //	where the file's header is stored. Return -1 if the name isn't
-//	in the directory.
+//	in the directory.  Only the bucket the name hashes to is read.
 //
 //	"name" -- the file name to look up
 //----------------------------------------------------------------------
 
 pair<int, int> Directory::Find(char *name)
 {
-    int i = FindIndex(name);
+    DirectoryBucket bucket;
+    int i;
 
+    if (fresh || numEntries == 0)
+        return make_pair(-1, -1);
+    ReadBlock(GetPointer(Hash(name) & ((1 << depth) - 1)), &bucket);
+    i = FindIndex(&bucket, name);
     if (i != -1)
-        return make_pair(table[i].sector, table[i].isDir);
+        return make_pair(bucket.entries[i].sector, bucket.entries[i].isDir);
     return make_pair(-1, -1);
 }
 
@@ -123,111 +387,151 @@ pair<int, int> Directory::Find(char *name)
 // Directory::Add
 // 	Add a file into the directory.  Return TRUE if successful;
 //	return FALSE if the file name is already in the directory, or if
-//	the directory is completely full, and has no more space for
-//	additional file names.
+//	the disk is too full for the directory to grow.  The bucket (or
+//	buckets, if it had to be split) and the header are written back
+//	right away.
 //
 //	"name" -- the name of the file being added
 //	"newSector" -- the disk sector containing the added file's header
+//	"isDir" -- is the file a directory?
+//	"freeMap" -- where to get sectors if the directory has to grow
 //----------------------------------------------------------------------
 
-bool Directory::Add(char *name, int newSector, bool isDir)
+bool Directory::Add(char *name, int newSector, bool isDir,
+                    PersistentBitmap *freeMap)
 {
-    if (FindIndex(name) != -1)
-        return FALSE;
+    DirectoryBucket bucket;
+    unsigned hash = Hash(name);
+    int index, block;
+    DirectoryEntry *entry;
 
-    for (int i = 0; i < tableSize; i++)
-        if (!table[i].inUse)
+    ASSERT(!fresh);
+    for (;;)
+    {
+        index = hash & ((1 << depth) - 1);
+        block = GetPointer(index);
+        ReadBlock(block, &bucket);
+        if (FindIndex(&bucket, name) != -1)
+            return FALSE;
+        if (bucket.count < (int)BucketEntries)
+            break;
+        if (!Split(index, block, &bucket, freeMap))
         {
-            table[i].inUse = TRUE;
-            table[i].isDir = isDir;
-            strncpy(table[i].name, name, FileNameMaxLen);
-            table[i].sector = newSector;
-            return TRUE;
+            WriteHeader(); // the table may have grown anyway
+            return FALSE;
         }
-    return FALSE; // no space.  Fix when we have extensible files.
+    }
+
+    entry = &bucket.entries[bucket.count++];
+    memset(entry, 0, sizeof(DirectoryEntry));
+    entry->inUse = TRUE;
+    entry->isDir = isDir;
+    strncpy(entry->name, name, FileNameMaxLen);
+    entry->sector = newSector;
+    WriteBlock(block, &bucket);
+    numEntries++;
+    WriteHeader();
+    return TRUE;
 }
 
 //----------------------------------------------------------------------
 // Directory::Remove
 // 	Remove a file name from the directory.  Return TRUE if successful;
-//	return FALSE if the file isn't in the directory.
+//	return FALSE if the file isn't in the directory.  The last entry
+//	of the bucket moves into the hole.
 //
 //	"name" -- the file name to be removed
 //----------------------------------------------------------------------
 
 bool Directory::Remove(char *name)
 {
-    int i = FindIndex(name);
+    DirectoryBucket bucket;
+    int block, i;
 
+    if (fresh || numEntries == 0)
+        return FALSE;
+    block = GetPointer(Hash(name) & ((1 << depth) - 1));
+    ReadBlock(block, &bucket);
+    i = FindIndex(&bucket, name);
     if (i == -1)
         return FALSE; // name not in directory
-    table[i].inUse = FALSE;
-    table[i].isDir = -1;
+    bucket.entries[i] = bucket.entries[--bucket.count];
+    memset(&bucket.entries[bucket.count], 0, sizeof(DirectoryEntry));
+    WriteBlock(block, &bucket);
+    numEntries--;
+    WriteHeader();
     return TRUE;
 }
 
-void Directory::RecursiveRemove(PersistentBitmap *freeMap)
+//----------------------------------------------------------------------
+// Directory::NextBucket
+// 	Step through the buckets of the directory, returning each one
+//	once even though several pointers may lead to it.  Return FALSE
+//	when there are no more.
+//
+//	"index" -- the pointer to continue from; updated
+//	"seen" -- sectors already returned
+//	"bucket" -- where to put the next bucket
+//----------------------------------------------------------------------
+
+bool Directory::NextBucket(int *index, Bitmap *seen, DirectoryBucket *bucket)
 {
-    FileHeader *fileHdr = new FileHeader;
-    Directory *subDir = new Directory(NumDirEntries);
-    OpenFile *openFile;
+    if (fresh)
+        return FALSE;
+    while (*index < (1 << depth))
+    {
+        int block = GetPointer((*index)++);
 
-    for(int i = 0; i < tableSize; i++) {
-        if (table[i].inUse) {
-            if (table[i].isDir == 1) {
-                openFile = new OpenFile(table[i].sector);
-                subDir->FetchFrom(openFile);
-                subDir->RecursiveRemove(freeMap); // 刪掉sub directory中的資料
-            }
-            fileHdr->FetchFrom(table[i].sector);
-            fileHdr->Deallocate(freeMap); // remove data blocks
-            freeMap->Clear(table[i].sector); // remove header block
+        if (!seen->Test(block))
+        {
+            seen->Mark(block);
+            ReadBlock(block, bucket);
+            return TRUE;
         }
     }
-    delete subDir;
-    delete fileHdr;
+    return FALSE;
 }
 
 //----------------------------------------------------------------------
-// Directory::List
-// 	List all the file names in the directory.
+// Directory::GetEntries
+// 	Copy the entries in use, in hash order, into "into", which must
+//	have room for NumEntries() of them.  Return how many there were.
 //----------------------------------------------------------------------
 
-void Directory::List()
+int Directory::GetEntries(DirectoryEntry *into)
 {
-    for (int i = 0; i < tableSize; i++) {
-        if (table[i].inUse) {
-            if (table[i].isDir == 1) {
-                printf("[D] %s\n", table[i].name);
-            }
-            else if (table[i].isDir == 0) {
-                printf("[F] %s\n", table[i].name);
-            }
-        }
-    }      
+    DirectoryBucket bucket;
+    Bitmap seen(numBlocks);
+    int index = 0, count = 0;
+
+    while (NextBucket(&index, &seen, &bucket))
+        for (int i = 0; i < bucket.count; i++)
+            into[count++] = bucket.entries[i];
+    ASSERT(count == numEntries);
+    return count;
 }
 
-void Directory::RecursiveList(int padding)
+//----------------------------------------------------------------------
+// Directory::List
+// 	List all the file names in the directory, in hash order.
+//----------------------------------------------------------------------
+
+void Directory::List()
 {
-    Directory *subDir = new Directory(NumDirEntries);
-    OpenFile *openFile;
+    DirectoryBucket bucket;
+    Bitmap seen(numBlocks);
+    int index = 0;
 
-    for(int i = 0; i < tableSize; i++) {
-        if (table[i].inUse) {
-            for(int i = 0; i < padding; i++) {
-                printf("    ");
-            }
-            if (table[i].isDir == 1) {
-                printf("[D] %s\n", table[i].name);
-                openFile = new OpenFile(table[i].sector);
-                subDir->FetchFrom(openFile);
-                subDir->RecursiveList(padding+1);
+    while (NextBucket(&index, &seen, &bucket)) {
+        for (int i = 0; i < bucket.count; i++) {
+            if (bucket.entries[i].isDir == 1) {
+                printf("[D] %s\n", bucket.entries[i].name);
             }
-            else if (table[i].isDir == 0) {
-                printf("[F] %s\n", table[i].name);
+            else if (bucket.entries[i].isDir == 0) {
+                printf("[F] %s\n", bucket.entries[i].name);
             }
         }
-    }
+    }      
 }
 
 //----------------------------------------------------------------------
@@ -238,16 +542,171 @@ void Directory::RecursiveList(int padding)
 
 void Directory::Print()
 {
-    FileHeader *hdr = new FileHeader;
+    DirectoryBucket bucket;
+    Bitmap seen(numBlocks);
+    int index = 0;
+    FileHeader *hdr;
 
-    printf("Directory contents:\n");
-    for (int i = 0; i < tableSize; i++)
-        if (table[i].inUse)
+    printf("Directory contents: %d entries, %d bucket pointers, %d sectors\n",
+           numEntries, 1 << depth, numBlocks);
+    while (NextBucket(&index, &seen, &bucket))
+        for (int i = 0; i < bucket.count; i++)
         {
-            printf("Name: %s, Sector: %d\n", table[i].name, table[i].sector);
-            hdr->FetchFrom(table[i].sector);
+            printf("Name: %s, Sector: %d\n", bucket.entries[i].name,
+                   bucket.entries[i].sector);
+            hdr = kernel->inodeTable->Get(bucket.entries[i].sector);
             hdr->Print();
+            kernel->inodeTable->Put(hdr);
         }
     printf("\n");
-    delete hdr;
+}
+
+//----------------------------------------------------------------------
+// DentryCache::DentryCache
+// 	Initialize an empty name cache.
+//
+//	"size" is the number of entries in the cache
+//----------------------------------------------------------------------
+
+DentryCache::DentryCache(int size)
+{
+    numEntries = size;
+    entries = new Dentry[size];
+    hashTable = new Dentry *[size];
+    clockHand = 0;
+    for (int i = 0; i < size; i++)
+    {
+        entries[i].parent = -1;
+        entries[i].referenced = FALSE;
+        entries[i].hashNext = NULL;
+        hashTable[i] = NULL;
+    }
+}
+
+//----------------------------------------------------------------------
+// DentryCache::~DentryCache
+// 	De-allocate the name cache.
+//----------------------------------------------------------------------
+
+DentryCache::~DentryCache()
+{
+    delete[] entries;
+    delete[] hashTable;
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Bucket
+// 	Return the hash bucket of "name" in directory "parent".
+//----------------------------------------------------------------------
+
+int DentryCache::Bucket(int parent, char *name)
+{
+    return (Directory::Hash(name) ^ (unsigned)parent * 2654435761u) % numEntries;
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Find
+// 	Return the entry for "name" in directory "parent", or NULL if
+//	there is none.
+//----------------------------------------------------------------------
+
+Dentry *DentryCache::Find(int parent, char *name)
+{
+    Dentry *entry;
+
+    for (entry = hashTable[Bucket(parent, name)]; entry != NULL;
+         entry = entry->hashNext)
+        if (entry->parent == parent &&
+            !strncmp(entry->name, name, FileNameMaxLen))
+            return entry;
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Unhash
+// 	Take an entry out of its hash chain.
+//----------------------------------------------------------------------
+
+void DentryCache::Unhash(Dentry *entry)
+{
+    Dentry **link = &hashTable[Bucket(entry->parent, entry->name)];
+
+    while (*link != entry)
+        link = &(*link)->hashNext;
+    *link = entry->hashNext;
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Lookup
+// 	Look up "name" in directory "parent".  Return TRUE, with the
+//	answer in "sector" and "isDir", if the cache knows it; the answer
+//	may be that there is no such file (sector -1).
+//----------------------------------------------------------------------
+
+bool DentryCache::Lookup(int parent, char *name, int *sector, int *isDir)
+{
+    Dentry *entry = Find(parent, name);
+
+    if (entry == NULL)
+    {
+        kernel->stats->numNameCacheMisses++;
+        return FALSE;
+    }
+    kernel->stats->numNameCacheHits++;
+    entry->referenced = TRUE;
+    *sector = entry->sector;
+    *isDir = entry->isDir;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Enter
+// 	Remember that "name" in directory "parent" is the file whose
+//	header is at "sector" (-1: there is no such file).  An entry for
+//	the same name is overwritten; otherwise the CLOCK picks the entry
+//	to reuse.
+//----------------------------------------------------------------------
+
+void DentryCache::Enter(int parent, char *name, int sector, int isDir)
+{
+    Dentry *entry = Find(parent, name);
+
+    if (entry == NULL)
+    {
+        while (entries[clockHand].referenced)
+        {
+            entries[clockHand].referenced = FALSE;
+            clockHand = (clockHand + 1) % numEntries;
+        }
+        entry = &entries[clockHand];
+        clockHand = (clockHand + 1) % numEntries;
+        if (entry->parent != -1)
+            Unhash(entry);
+
+        entry->parent = parent;
+        strncpy(entry->name, name, FileNameMaxLen);
+        entry->name[FileNameMaxLen] = '\0';
+        entry->hashNext = hashTable[Bucket(parent, name)];
+        hashTable[Bucket(parent, name)] = entry;
+    }
+    entry->sector = sector;
+    entry->isDir = isDir;
+    entry->referenced = TRUE;
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Purge
+// 	Forget every entry.  Used when a directory goes away, since the
+//	entries of everything below it would otherwise outlive it.
+//----------------------------------------------------------------------
+
+void DentryCache::Purge()
+{
+    for (int i = 0; i < numEntries; i++)
+    {
+        entries[i].parent = -1;
+        entries[i].referenced = FALSE;
+        entries[i].hashNext = NULL;
+        hashTable[i] = NULL;
+    }
 }
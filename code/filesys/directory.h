@@ -1,7 +1,7 @@
 // directory.h
 //	Data structures to manage a UNIX-like directory of file names.
 //
-//      A directory is a table of pairs: <file name, sector #>,
+//      A directory is a set of pairs: <file name, sector #>,
 //	giving the name of each file in the directory, and
 //	where to find its file header (the data structure describing
 //	where to find the file's data blocks) on disk.
@@ -18,6 +18,7 @@
 #define DIRECTORY_H
 
 #include "openfile.h"
+#include "pbitmap.h"
 #include "debug.h"
 
 #define FileNameMaxLen 9 // for simplicity, we assume \
@@ -41,22 +42,49 @@ public:
                                    // the trailing '\0'
 };
 
+// A directory is stored on disk as a hash table of "buckets", one
+// sector each (extendible hashing).  Each bucket holds the entries whose
+// names hash to it; when a bucket fills up it is split in two, and the
+// directory file grows by one sector.  The name's hash indexes a table
+// of bucket pointers, which is kept in the directory's first sector
+// while it is small, and in sectors of its own once it is not.
+//
+// So finding a name costs reading the header and one bucket (plus one
+// sector of the pointer table, for very large directories), however
+// many files the directory holds.
+
+#define BucketEntries ((SectorSize - 2 * sizeof(int)) / sizeof(DirectoryEntry)) // 5 entries per bucket
+
+class DirectoryBucket
+{
+public:
+    int localDepth; // How many bits of the hash all names here share
+    int count;      // Number of entries in use, at the front
+    DirectoryEntry entries[BucketEntries];
+};
+
+// header sector 前面放 5 個 int，後面放小 table 的 bucket pointer
+#define DirHeaderFields 5
+#define InlinePointers 16 // pointer table fits in the header up to this size
+#define PointersPerSector (SectorSize / sizeof(int))
+#define MaxDirDepth 24
+
 // The following class defines a UNIX-like "directory".  Each entry in
 // the directory describes a file, and where to find it on disk.
 //
-// The directory data structure can be stored in memory, or on disk.
-// When it is on disk, it is stored as a regular Nachos file.
+// The directory data structure is stored on disk as a regular Nachos
+// file.  Only its header is kept in memory: FetchFrom reads it, and
+// Find, Add and Remove read and write just the buckets they need
+// (Add and Remove write their changes to disk right away).
 //
-// The constructor initializes a directory structure in memory; the
-// FetchFrom/WriteBack operations shuffle the directory information
-// from/to disk.
+// The constructor initializes an empty directory in memory; WriteBack
+// stores it, the first time, into a newly allocated directory file.
 
 class Directory
 {
 public:
-    Directory(int size); // Initialize an empty directory
-                         // with space for "size" files
-    ~Directory();        // De-allocate the directory
+    Directory(); // Initialize an empty directory
+    ~Directory(); // De-allocate the directory
 
     void FetchFrom(OpenFile *file); // Init directory contents from disk
     void WriteBack(OpenFile *file); // Write modifications to
@@ -66,13 +94,15 @@ public:
                           // FileHeader for file: "name"
                           // return value: <sector number, isDir>
 
-    bool Add(char *name, int newSector, bool isDir); // Add a file name into the directory
-
-    void RecursiveRemove(PersistentBitmap *freeMap);
+    bool Add(char *name, int newSector, bool isDir,
+             PersistentBitmap *freeMap); // Add a file name into the
+                                         // directory, growing it if
+                                         // needed
 
     bool Remove(char *name); // Remove a file from the directory
 
-    void RecursiveList(int padding);
+    int NumEntries() { return numEntries; } // Number of names in it
+    int GetEntries(DirectoryEntry *into); // Copy out the entries in use
 
     void List();  // Print the names of all the files
                   //  in the directory
@@ -80,20 +110,97 @@ public:
                   //  of the directory -- all the file
                   //  names and their contents.
 
+    static unsigned Hash(char *name); // Hash of a file name
+
 private:
     /*
 		MP4 Hint:
 		Directory is actually a "file", be careful of how it works with OpenFile and FileHdr.
-		Disk part: table
-		In-core part: tableSize
+		Disk part: header fields and inlineTable (the first sector),
+		           pointer table, buckets
+		In-core part: file, fresh
 	*/
 
-    int tableSize;         // Number of directory entries
-    DirectoryEntry *table; // Table of pairs:
-                           // <file name, file header location>
+    int numEntries; // Number of files in the directory
+    int depth;      // Bits of the hash used to index the pointer table
+    int numBlocks;  // Sectors of the directory file in use
+    int tableBlock; // First sector of the pointer table, -1 while it
+                    // is in the header
+    int freeBlock;  // First of a list of unused sectors, -1 if none
+    int inlineTable[InlinePointers]; // Pointer table, while it is small
+
+    OpenFile *file; // Where the directory is stored
+    bool fresh;     // Not yet stored anywhere?
+
+    int GetPointer(int index);            // Bucket pointer "index"
+    void SetPointer(int index, int block); // Change bucket pointer "index"
+    void ReadBlock(int block, DirectoryBucket *bucket);  // Read/write a
+    void WriteBlock(int block, DirectoryBucket *bucket); // bucket sector
+    void WriteHeader(); // Store the header fields in the first sector
+
+    int AppendBlocks(int count, PersistentBitmap *freeMap); // Add sectors
+                                                            // to the file
+    int NewBlock(PersistentBitmap *freeMap); // Find a sector for a bucket
+    void FreeBlock(int block);               // Put a sector on the free list
+    bool DoubleTable(PersistentBitmap *freeMap);  // One more bit of hash
+    bool Split(int index, int block, DirectoryBucket *bucket,
+               PersistentBitmap *freeMap); // Split a full bucket
+
+    int FindIndex(DirectoryBucket *bucket, char *name); // Find the index
+                               // into a bucket corresponding to "name"
+    bool NextBucket(int *index, Bitmap *seen, DirectoryBucket *bucket);
+                               // Walk the buckets, each once
+};
+
+// The following class defines one entry of the name cache: the result
+// of looking up "name" in the directory whose header is at "parent".
+// A negative entry (sector -1) remembers that the name is not there.
 
-    int FindIndex(char *name); // Find the index into the directory
-                               //  table corresponding to "name"
+class Dentry
+{
+public:
+    int parent;                    // Header sector of the directory,
+                                   //   -1 if the entry is unused
+    char name[FileNameMaxLen + 1]; // Name looked up in it
+    int sector;                    // Header sector of the file, -1 if
+                                   //   there is no such file
+    int isDir;                     // 1: dir, 0: file
+    bool referenced;               // Used since the clock hand last passed?
+    Dentry *hashNext;              // Next entry in the same hash bucket
+};
+
+// The following class defines a cache of path components (in UNIX
+// terms, the "dentry cache").  FileSystem asks it first at each step
+// of a path, and only reads the directory on a miss; whatever the
+// directory says, found or not, is then entered.  Entries are replaced
+// by the CLOCK algorithm.
+//
+// The cache must be kept up to date by whoever adds or removes names.
+
+class DentryCache
+{
+public:
+    DentryCache(int size); // Initialize an empty cache of "size" entries
+    ~DentryCache();        // De-allocate the cache
+
+    bool Lookup(int parent, char *name, int *sector, int *isDir);
+                                     // Look up "name" in directory
+                                     // "parent"; FALSE if not cached
+    void Enter(int parent, char *name, int sector, int isDir);
+                                     // Remember the result of a lookup,
+                                     // or of an Add/Remove
+    void Purge();                    // Forget everything
+
+private:
+    int numEntries;      // Size of the cache
+    Dentry *entries;     // The entries
+    Dentry **hashTable;  // Entries hashed by (parent, name)
+    int clockHand;       // Next entry the CLOCK looks at
+
+    Dentry *Find(int parent, char *name); // Find a cached entry
+    int Bucket(int parent, char *name);   // Hash bucket of a key
+    void Unhash(Dentry *entry);           // Take an entry out of the
+                                          // hash table
 };
 
 #endif // DIRECTORY_H
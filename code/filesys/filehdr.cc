@@ -3,12 +3,20 @@
 //	would be called the i-node).
 //
 //	The file header is used to locate where on disk the
-//	file's data is stored.  We implement this as a fixed size
-//	table of pointers -- each entry in the table points to the
-//	disk sector containing that portion of the file data
-//	(in other words, there are no indirect or doubly indirect
-//	blocks). The table size is chosen so that the file header
-//	will be just big enough to fit in one disk sector,
+//	file's data is stored.  We implement this as a list of extents --
+//	each extent is a run of consecutive disk sectors holding the next
+//	part of the file data.  Data blocks are allocated in runs that are
+//	as long as the free map allows, so a large file is normally
+//	described by a handful of extents.  The first few extents are kept
+//	in the header sector itself; any more spill into a chain of extra
+//	sectors hung off the header.
+//
+//	Parts of a file may be holes, with no sectors at all; they read
+//	as zeros, and get sectors when they are first written.  A new
+//	file starts out as one big hole, so creating it costs nothing
+//	however large it is.  A new file small enough starts out inline
+//	instead: its data lives in the header sector, so reading it takes
+//	one disk read, until it grows too big.
 //
 //      Unlike in a real system, we do not keep track of file permissions,
 //	ownership, last modification date, etc., in the file header.
@@ -40,19 +48,131 @@ FileHeader::FileHeader()
 {
 	numBytes = -1;
 	numSectors = -1;
-	memset(dataSectors, -1, sizeof(dataSectors));
+	numExtents = 0;
+	chainSector = -1;
+	extents = NULL;
+	extentFirst = NULL;
+	extentCapacity = 0;
+	chain = NULL;
+	numChain = 0;
+	inlined = FALSE;
 }
 
 //----------------------------------------------------------------------
 // MP4 mod tag
 // FileHeader::~FileHeader
-//	Currently, there is not need to do anything in destructor function.
-//	However, if you decide to add some "in-core" data in header
-//	Always remember to deallocate their space or you will leak memory
+//	Free the in-core extent list and chain.
 //----------------------------------------------------------------------
 FileHeader::~FileHeader()
 {
-	// nothing to do now
+	delete[] extents;
+	delete[] extentFirst;
+	delete[] chain;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::AddExtent
+// 	Append a run of sectors to the end of the file's extent list.
+//	If the run starts right where the last extent ends, the last
+//	extent just gets longer; so does a hole that follows a hole.
+//
+//	"start" is the first disk sector of the run, -1 for a hole
+//	"length" is the number of sectors in the run
+//----------------------------------------------------------------------
+
+void FileHeader::AddExtent(int start, int length)
+{
+	Extent *last = (numExtents > 0) ? &extents[numExtents - 1] : NULL;
+
+	if (last != NULL && ((last->start == -1) ? (start == -1)
+											  : (last->start + last->length == start)))
+	{
+		last->length += length;
+		numSectors += length;
+		return;
+	}
+
+	if (numExtents == extentCapacity)
+	{
+		// 空間不夠就變兩倍
+		int newCapacity = (extentCapacity == 0) ? NumExtents : 2 * extentCapacity;
+		Extent *newExtents = new Extent[newCapacity];
+		int *newFirst = new int[newCapacity];
+
+		memcpy(newExtents, extents, numExtents * sizeof(Extent));
+		memcpy(newFirst, extentFirst, numExtents * sizeof(int));
+		delete[] extents;
+		delete[] extentFirst;
+		extents = newExtents;
+		extentFirst = newFirst;
+		extentCapacity = newCapacity;
+	}
+	extents[numExtents].start = start;
+	extents[numExtents].length = length;
+	extentFirst[numExtents] = numSectors;
+	numExtents++;
+	numSectors += length;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ReserveChain
+// 	Make sure there are enough chain sectors to hold every extent
+//	that does not fit in the header sector, and free any that are no
+//	longer needed.  Return FALSE if the disk is full.
+//
+//	"freeMap" is the bit map of free disk sectors
+//----------------------------------------------------------------------
+
+bool FileHeader::ReserveChain(PersistentBitmap *freeMap)
+{
+	int needed = 0;
+
+	if (numExtents > (int)NumExtents)
+		needed = divRoundUp(numExtents - NumExtents, NumChainExtents);
+	while (numChain > needed)
+	{
+		freeMap->Clear(chain[--numChain]);
+		kernel->synchDisk->Revoke(chain[numChain]);
+	}
+
+	while (numChain < needed)
+	{
+		int sector = freeMap->FindAndSet();
+		if (sector < 0)
+			return FALSE;
+
+		int *newChain = new int[numChain + 1];
+		memcpy(newChain, chain, numChain * sizeof(int));
+		newChain[numChain++] = sector;
+		delete[] chain;
+		chain = newChain;
+	}
+	chainSector = (numChain > 0) ? chain[0] : -1;
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::FindExtent
+// 	Return the index of the extent that holds a sector of the file.
+//	extentFirst is sorted, so a binary search will do.
+//
+//	"fileSector" is the sector number relative to the start of the file
+//----------------------------------------------------------------------
+
+int FileHeader::FindExtent(int fileSector)
+{
+	int lo = 0, hi = numExtents - 1;
+
+	ASSERT(fileSector >= 0 && fileSector < numSectors);
+	while (lo < hi)
+	{
+		int mid = (lo + hi + 1) / 2;
+		if (extentFirst[mid] <= fileSector)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
 }
 
 //----------------------------------------------------------------------
@@ -60,7 +180,12 @@ FileHeader::~FileHeader()
 // 	Initialize a fresh file header for a newly created file.
 //	Allocate data blocks for the file out of the map of free disk blocks.
 //	Return FALSE if there are not enough free blocks to accomodate
-//	the new file.
+//	the new file, counting the chain sectors its extents turn out to
+//	need; nothing stays marked in the free map then.
+//
+//	Each extent is asked from the free map as one contiguous run;
+//	only when the disk has no run that long do we take a shorter
+//	one and continue with the rest of the file.
 //
 //	"freeMap" is the bit map of free disk sectors
 //	"fileSize" is the bit map of free disk sectors
@@ -68,182 +193,530 @@ FileHeader::~FileHeader()
 
 bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
 {
+	int wanted = divRoundUp(fileSize, SectorSize);
+
 	numBytes = fileSize;
-	numSectors = divRoundUp(fileSize, SectorSize);
+	numSectors = 0;
+	numExtents = 0;
+	inlined = FALSE;
+	delete[] chain; // the header may be reused from the inode table
+	chain = NULL;
+	numChain = 0;
 
-	if (freeMap->NumClear() < numSectors)
+	if (freeMap->NumClear() < wanted)
 		return FALSE; // not enough space
 
-	if (fileSize > MaxFileSize2)
+	while (numSectors < wanted)
 	{
-		for (int i = 0; fileSize > 0; i++)
+		int length;
+		int start = freeMap->FindAndSetRange(wanted - numSectors, &length);
+
+		// since we checked that there was enough free space,
+		// we expect this to succeed
+		ASSERT(start >= 0);
+		AddExtent(start, length);
+	}
+	if (!ReserveChain(freeMap))
+	{ // chain 放不下，已經拿到的都還回去
+		Deallocate(freeMap);
+		numSectors = 0;
+		numExtents = 0;
+		numChain = 0;
+		chainSector = -1;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::AllocateSparse
+// 	Initialize a fresh file header for a newly created file, without
+//	allocating any data blocks: the whole file is a hole, and reads
+//	as zeros until it is written.  A file that fits in the header is
+//	inline instead.
+//
+//	"fileSize" is the length of the new file, in bytes
+//----------------------------------------------------------------------
+
+void FileHeader::AllocateSparse(int fileSize)
+{
+	numBytes = fileSize;
+	numSectors = 0;
+	numExtents = 0;
+	chainSector = -1;
+	delete[] chain; // the header may be reused from the inode table
+	chain = NULL;
+	numChain = 0;
+	inlined = (fileSize <= MaxInlineBytes);
+	if (inlined)
+		memset(inlineData, 0, MaxInlineBytes);
+	else
+		AddExtent(-1, divRoundUp(fileSize, SectorSize));
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ReadInline/WriteInline
+// 	Copy "numBytes" bytes of an inline file, starting at "position",
+//	out of or into the header.  A write may go past the end of the
+//	file, as long as it stays within MaxInlineBytes; what it skips
+//	is already zeros.
+//----------------------------------------------------------------------
+
+void FileHeader::ReadInline(char *into, int numBytes, int position)
+{
+	ASSERT(inlined && position + numBytes <= this->numBytes);
+	bcopy(&inlineData[position], into, numBytes);
+}
+
+void FileHeader::WriteInline(char *from, int numBytes, int position)
+{
+	ASSERT(inlined && position + numBytes <= MaxInlineBytes);
+	bcopy(from, &inlineData[position], numBytes);
+	this->numBytes = max(this->numBytes, position + numBytes);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::MoveInline
+// 	An inline file is growing too big for the header.  Copy its data
+//	into "into" (room for MaxInlineBytes), and turn it into a normal
+//	file, all hole, of the same length; the caller writes the data
+//	back into it.
+//----------------------------------------------------------------------
+
+void FileHeader::MoveInline(char *into)
+{
+	ASSERT(inlined);
+	bcopy(inlineData, into, numBytes);
+	inlined = FALSE;
+	if (numBytes > 0)
+		AddExtent(-1, divRoundUp(numBytes, SectorSize));
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Extend
+// 	Make an existing file longer, allocating the data blocks that the
+//	new part needs.  Return FALSE, leaving the file as it was, if the
+//	disk does not have enough free blocks.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"newSize" is the new length of the file, in bytes
+//----------------------------------------------------------------------
+
+bool FileHeader::Extend(PersistentBitmap *freeMap, int newSize)
+{
+	if (newSize <= numBytes)
+		return TRUE;
+	if (!Reserve(freeMap, divRoundUp(newSize, SectorSize)))
+		return FALSE;
+	numBytes = newSize;
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Reserve
+// 	Make sure the file has at least "wanted" data sectors, without
+//	changing its length; sectors past the end of the file are held
+//	for it to grow into.  Return FALSE, leaving the file as it was,
+//	if the disk does not have enough free blocks.
+//
+//	Sectors right after the last extent are taken first, so that it
+//	just grows; the rest come from the group of the file's last sector.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"wanted" is the number of data sectors the file should have
+//	"dataStart" -- the new sectors before this one are left as a hole
+//----------------------------------------------------------------------
+
+bool FileHeader::Reserve(PersistentBitmap *freeMap, int wanted, int dataStart)
+{
+	int oldSectors = numSectors;
+
+	if (wanted <= numSectors)
+		return TRUE;
+	if (freeMap->NumClear() < wanted - max(numSectors, dataStart))
+		return FALSE; // not enough space
+
+	if (dataStart > numSectors)
+		AddExtent(-1, min(dataStart, wanted) - numSectors);
+	if (numExtents > 0 && extents[numExtents - 1].start != -1)
+	{
+		int next = extents[numExtents - 1].start + extents[numExtents - 1].length;
+		while (numSectors < wanted && next < NumSectors && !freeMap->Test(next))
 		{
-			// 找到一個 sector 當作 header
-			dataSectors[i] = freeMap->FindAndSet();
-			ASSERT(dataSectors[i] >= 0);
-
-			// 把這個 sector 當作 header
-			FileHeader *subHeader = new FileHeader;
-
-			// 檢查這個 filesize 還有多少
-			if (fileSize > MaxFileSize2)
-			{
-				// 如果 fileSize 還大於 MaxFileSize 代表要繼續做遞迴
-				subHeader->Allocate(freeMap, MaxFileSize2);
-				fileSize -= MaxFileSize2;
-			}
-			else
-			{
-				// 代表剩下的 file 不會超過一個 fileHeader 可以容納的 sector
-				subHeader->Allocate(freeMap, fileSize);
-				fileSize -= fileSize;
-			}
-			// 紀錄這個 header 紀錄了幾個 sector
-			numSectors = i+1;
-			subHeader->WriteBack(dataSectors[i]);
-			delete subHeader;
+			freeMap->Mark(next);
+			AddExtent(next++, 1);
 		}
+		freeMap->PlaceNear(next - 1);
 	}
-	else if (fileSize > MaxFileSize1)
+	while (numSectors < wanted)
 	{
-		for (int i = 0; fileSize > 0; i++)
+		int length;
+		int start = freeMap->FindAndSetRange(wanted - numSectors, &length);
+
+		ASSERT(start >= 0);
+		AddExtent(start, length);
+	}
+	if (!ReserveChain(freeMap))
+	{
+		// 沒有空間放 chain，把剛剛拿的 sector 都還回去
+		Shrink(freeMap, oldSectors);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Fill
+// 	Give the holes among the "count" file sectors starting at "first"
+//	disk sectors of their own.  Each part of a hole goes right after
+//	the data before it, if that sector is free, or else near it, so
+//	a file written from start to end is laid out as if it had been
+//	allocated all at once.  Return FALSE if the disk is too full.
+//
+//	Splitting holes adds extents, which may need more chain sectors
+//	than there are left once the data sectors are taken.  Then the
+//	header goes back to the way it was, and every sector taken here
+//	is given back.
+//
+//	"freeMap" is the bit map of free disk sectors
+//----------------------------------------------------------------------
+
+bool FileHeader::Fill(PersistentBitmap *freeMap, int first, int count)
+{
+	int end = min(first + count, numSectors);
+	int i, n, e, prev, start, length, holes = 0;
+	Extent *saved, *runs;
+	int savedCount, numRuns = 0;
+
+	for (i = first; i < end; i++)
+		if (ByteToSector(i * SectorSize) == -1)
+			holes++;
+	if (holes == 0)
+		return TRUE;
+	if (freeMap->NumClear() < holes)
+		return FALSE;
+
+	savedCount = numExtents;
+	saved = new Extent[max(savedCount, 1)];
+	memcpy(saved, extents, savedCount * sizeof(Extent));
+	runs = new Extent[holes];
+	for (i = first; i < end; i += n)
+	{
+		e = FindExtent(i);
+		n = min(end, extentFirst[e] + extents[e].length) - i;
+		if (extents[e].start != -1)
+			continue;
+
+		prev = (i > 0) ? ByteToSector((i - 1) * SectorSize) : -1;
+		if (prev >= 0 && prev + 1 < NumSectors && !freeMap->Test(prev + 1))
 		{
-			// 找到一個 sector 當作 header
-			dataSectors[i] = freeMap->FindAndSet();
-			ASSERT(dataSectors[i] >= 0);
-
-			// 把這個 sector 當作 header
-			FileHeader *subHeader = new FileHeader;
-
-			// 檢查這個 filesize 還有多少
-			if (fileSize > MaxFileSize1)
-			{
-				// 如果 fileSize 還大於 MaxFileSize 代表要繼續做遞迴
-				subHeader->Allocate(freeMap, MaxFileSize1);
-				fileSize -= MaxFileSize1;
-			}
-			else
-			{
-				subHeader->Allocate(freeMap, fileSize);
-				fileSize -= fileSize;
-			}
-			// 紀錄這個 header 紀錄了幾個 sector
-			numSectors = i+1;
-			subHeader->WriteBack(dataSectors[i]);
-			delete subHeader;
+			// 接在前一段 data 後面
+			start = prev + 1;
+			for (length = 0; length < n && start + length < NumSectors &&
+							 !freeMap->Test(start + length);
+				 length++)
+				freeMap->Mark(start + length);
 		}
+		else
+		{
+			if (prev >= 0)
+				freeMap->PlaceNear(prev);
+			start = freeMap->FindAndSetRange(n, &length);
+			ASSERT(start >= 0);
+		}
+		MapRun(i, start, length);
+		runs[numRuns].start = start;
+		runs[numRuns++].length = length;
+		n = length;
 	}
-	else if (fileSize > MaxFileSize)
+	if (ReserveChain(freeMap))
 	{
-		for (int i = 0; fileSize > 0; i++)
+		delete[] saved;
+		delete[] runs;
+		return TRUE;
+	}
+
+	// 沒有空間放 chain：剛填上的 sector 還回去，extent list 恢復原狀
+	for (i = 0; i < numRuns; i++)
+		for (int j = 0; j < runs[i].length; j++)
 		{
-			// 找到一個 sector 當作 header
-			dataSectors[i] = freeMap->FindAndSet();
-			ASSERT(dataSectors[i] >= 0);
-
-			// 把這個 sector 當作 header
-			FileHeader *subHeader = new FileHeader;
-
-			// 檢查這個 filesize 還有多少
-			if (fileSize > MaxFileSize)
-			{
-				// 如果 fileSize 還大於 MaxFileSize 代表要繼續做遞迴
-				subHeader->Allocate(freeMap, MaxFileSize);
-				fileSize -= MaxFileSize;
-			}
-			else
-			{
-				// 代表剩下的 file 不會超過一個 fileHeader 可以容納的 sector
-				subHeader->Allocate(freeMap, fileSize);
-				fileSize -= fileSize;
-			}
-			// 紀錄這個 header 紀錄了幾個 sector
-			numSectors = i+1;
-			subHeader->WriteBack(dataSectors[i]);
-			delete subHeader;
+			freeMap->Clear(runs[i].start + j);
+			kernel->synchDisk->Revoke(runs[i].start + j);
 		}
-	}
-	else
+	delete[] runs;
+	delete[] extents;
+	delete[] extentFirst;
+	extents = NULL;
+	extentFirst = NULL;
+	extentCapacity = 0;
+	numExtents = 0;
+	numSectors = 0;
+	for (int j = 0; j < savedCount; j++)
+		AddExtent(saved[j].start, saved[j].length);
+	delete[] saved;
+	ReserveChain(freeMap); // only gives chain sectors back
+	return FALSE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::MapRun
+// 	Put the "length" disk sectors starting at "start" in place of the
+//	hole sectors of the file starting at "fileSector".  The hole is
+//	split around them, and the run joins the extents next to it when
+//	they continue on disk.
+//----------------------------------------------------------------------
+
+void FileHeader::MapRun(int fileSector, int start, int length)
+{
+	Extent *old = extents;
+	int *oldFirst = extentFirst;
+	int count = numExtents;
+	int i = FindExtent(fileSector);
+	int rest;
+
+	ASSERT(old[i].start == -1 &&
+		   fileSector + length <= oldFirst[i] + old[i].length);
+
+	// 重新建 extent list，順便把接得起來的合併
+	extents = NULL;
+	extentFirst = NULL;
+	extentCapacity = 0;
+	numExtents = 0;
+	numSectors = 0;
+	for (int j = 0; j < count; j++)
 	{
-		for (int i = 0; i < numSectors; i++)
+		if (j != i)
 		{
-			// 把 disk 現在空的 sector 位置回傳給這個 file header 的 table 紀錄下來
-			dataSectors[i] = freeMap->FindAndSet();
-			// since we checked that there was enough free space,
-			// we expect this to succeed
-			ASSERT(dataSectors[i] >= 0);
+			AddExtent(old[j].start, old[j].length);
+			continue;
 		}
+		if (fileSector > oldFirst[i])
+			AddExtent(-1, fileSector - oldFirst[i]);
+		AddExtent(start, length);
+		rest = oldFirst[i] + old[i].length - fileSector - length;
+		if (rest > 0)
+			AddExtent(-1, rest);
 	}
-	return TRUE;
+	delete[] old;
+	delete[] oldFirst;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::HasHole
+// 	Return TRUE if any of the file sectors "first" to "last" is part
+//	of a hole.
+//----------------------------------------------------------------------
+
+bool FileHeader::HasHole(int first, int last)
+{
+	last = min(last, numSectors - 1);
+	if (first > last)
+		return FALSE;
+	for (int i = FindExtent(first); i < numExtents && extentFirst[i] <= last; i++)
+		if (extents[i].start == -1)
+			return TRUE;
+	return FALSE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ReleaseTail
+// 	Give back the data sectors held past the end of the file.
+//
+//	"freeMap" is the bit map of free disk sectors
+//----------------------------------------------------------------------
+
+void FileHeader::ReleaseTail(PersistentBitmap *freeMap)
+{
+	Shrink(freeMap, divRoundUp(numBytes, SectorSize));
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Shrink
+// 	Cut the file's data down to its first "keep" sectors, freeing the
+//	rest, along with any chain sectors the shorter extent list no
+//	longer needs.
+//----------------------------------------------------------------------
+
+void FileHeader::Shrink(PersistentBitmap *freeMap, int keep)
+{
+	int last, sector;
+
+	if (keep >= numSectors)
+		return;
+	for (int i = keep; i < numSectors; i++)
+		if ((sector = ByteToSector(i * SectorSize)) != -1)
+		{
+			freeMap->Clear(sector);
+			kernel->synchDisk->Revoke(sector);
+		}
+
+	if (keep == 0)
+		numExtents = 0;
+	else
+	{
+		last = FindExtent(keep - 1);
+		extents[last].length = keep - extentFirst[last];
+		numExtents = last + 1;
+	}
+	numSectors = keep;
+	ReserveChain(freeMap); // only gives chain sectors back
+}
+
+//----------------------------------------------------------------------
+// FileHeader::SetLength
+// 	Set the length of the file; it must fit in the sectors the file
+//	already has.
+//----------------------------------------------------------------------
+
+void FileHeader::SetLength(int length)
+{
+	ASSERT(divRoundUp(length, SectorSize) <= numSectors);
+	numBytes = length;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::MappedSectors
+// 	Return the number of file sectors the extent list covers: those
+//	in holes, and any past the end of the file, included.
+//----------------------------------------------------------------------
+
+int FileHeader::MappedSectors()
+{
+	return numSectors;
 }
 
 //----------------------------------------------------------------------
 // FileHeader::Deallocate
-// 	De-allocate all the space allocated for data blocks for this file.
+// 	De-allocate all the space allocated for data blocks for this file,
+//	along with the chain sectors holding its extents.  Each sector is
+//	revoked in the journal, so that an image of it still in the log
+//	is not replayed once the sector holds something else.
 //
 //	"freeMap" is the bit map of free disk sectors
 //----------------------------------------------------------------------
 
 void FileHeader::Deallocate(PersistentBitmap *freeMap)
 {
-	FileHeader *fh = new FileHeader;
-	if (numBytes > MaxFileSize)
+	for (int i = 0; i < numExtents; i++)
 	{
-		for (int i = 0; i < numSectors; i++)
+		if (extents[i].start == -1)
+			continue; // a hole
+		for (int j = 0; j < extents[i].length; j++)
 		{
-			fh->FetchFrom(dataSectors[i]);
-			fh->Deallocate(freeMap);
-			ASSERT(freeMap->Test((int)dataSectors[i]));
-			freeMap->Clear((int)dataSectors[i]);
+			int sector = extents[i].start + j;
+			ASSERT(freeMap->Test(sector)); // ought to be marked!
+			freeMap->Clear(sector);
+			kernel->synchDisk->Revoke(sector);
 		}
 	}
-	else
+	for (int i = 0; i < numChain; i++)
 	{
-		for (int i = 0; i < numSectors; i++)
-		{
-			ASSERT(freeMap->Test((int)dataSectors[i])); // ought to be marked!
-			freeMap->Clear((int)dataSectors[i]);
-		}
+		ASSERT(freeMap->Test(chain[i]));
+		freeMap->Clear(chain[i]);
+		kernel->synchDisk->Revoke(chain[i]);
 	}
-	delete fh;
 }
 
 //----------------------------------------------------------------------
 // FileHeader::FetchFrom
-// 	Fetch contents of file header from disk.
+// 	Fetch contents of file header from disk, following the chain
+//	to bring the whole extent list into memory.
 //
 //	"sector" is the disk sector containing the file header
 //----------------------------------------------------------------------
 
 void FileHeader::FetchFrom(int sector)
 {
-	kernel->synchDisk->ReadSector(sector, (char *)this);
+	char buf[SectorSize];
+	int total, done, next, count;
+
+	kernel->synchDisk->ReadSector(sector, buf);
+	memcpy(&numBytes, buf, sizeof(int));
+	memcpy(&total, buf + sizeof(int), sizeof(int)); // numSectors, rebuilt below
+	memcpy(&numExtents, buf + 2 * sizeof(int), sizeof(int));
+	memcpy(&chainSector, buf + 3 * sizeof(int), sizeof(int));
+	inlined = (numExtents == -1);
+	if (inlined)
+	{ // 資料就在 header 裡
+		memcpy(inlineData, buf + NumHeaderFields * sizeof(int), MaxInlineBytes);
+		numExtents = 0;
+	}
+
+	// 重新建立 in-core 的 extent list
+	delete[] extents;
+	delete[] extentFirst;
+	delete[] chain;
+	extentCapacity = max(numExtents, (int)NumExtents);
+	extents = new Extent[extentCapacity];
+	extentFirst = new int[extentCapacity];
+	chain = NULL;
+	numChain = 0;
+
+	done = min(numExtents, (int)NumExtents);
+	memcpy(extents, buf + NumHeaderFields * sizeof(int), done * sizeof(Extent));
 
-	/*
-		MP4 Hint:
-		After you add some in-core informations, you will need to rebuild the header's structure
-	*/
+	next = chainSector;
+	if (numExtents > (int)NumExtents)
+		chain = new int[divRoundUp(numExtents - NumExtents, NumChainExtents)];
+	while (done < numExtents)
+	{
+		ASSERT(next >= 0);
+		chain[numChain++] = next;
+		kernel->synchDisk->ReadSector(next, buf);
+		memcpy(&next, buf, sizeof(int));
+		memcpy(&count, buf + sizeof(int), sizeof(int));
+		memcpy(&extents[done], buf + 2 * sizeof(int), count * sizeof(Extent));
+		done += count;
+	}
+
+	numSectors = 0;
+	for (int i = 0; i < numExtents; i++)
+	{
+		extentFirst[i] = numSectors;
+		numSectors += extents[i].length;
+	}
+	ASSERT(numSectors == total);
 }
 
 //----------------------------------------------------------------------
 // FileHeader::WriteBack
-// 	Write the modified contents of the file header back to disk.
+// 	Write the modified contents of the file header back to disk,
+//	together with any chain sectors.
 //
 //	"sector" is the disk sector to contain the file header
 //----------------------------------------------------------------------
 
 void FileHeader::WriteBack(int sector)
 {
-	kernel->synchDisk->WriteSector(sector, (char *)this);
+	char buf[SectorSize];
+	int done, count, next;
+	int inlineFlag = -1;
 
-	/*
-		MP4 Hint:
-		After you add some in-core informations, you may not want to write all fields into disk.
-		Use this instead:
-		char buf[SectorSize];
-		memcpy(buf + offset, &dataToBeWritten, sizeof(dataToBeWritten));
-		...
-	*/
+	ASSERT(numExtents <= (int)(NumExtents + numChain * NumChainExtents));
+
+	memset(buf, 0, SectorSize);
+	memcpy(buf, &numBytes, sizeof(int));
+	memcpy(buf + sizeof(int), &numSectors, sizeof(int));
+	memcpy(buf + 2 * sizeof(int), inlined ? &inlineFlag : &numExtents, sizeof(int));
+	memcpy(buf + 3 * sizeof(int), &chainSector, sizeof(int));
+	done = min(numExtents, (int)NumExtents);
+	if (inlined)
+		memcpy(buf + NumHeaderFields * sizeof(int), inlineData, MaxInlineBytes);
+	else
+		memcpy(buf + NumHeaderFields * sizeof(int), extents, done * sizeof(Extent));
+	kernel->synchDisk->WriteSector(sector, buf);
+
+	for (int i = 0; i < numChain && done < numExtents; i++)
+	{
+		count = min(numExtents - done, (int)NumChainExtents);
+		next = (i + 1 < numChain) ? chain[i + 1] : -1;
+		memset(buf, 0, SectorSize);
+		memcpy(buf, &next, sizeof(int));
+		memcpy(buf + sizeof(int), &count, sizeof(int));
+		memcpy(buf + 2 * sizeof(int), &extents[done], count * sizeof(Extent));
+		kernel->synchDisk->WriteSector(chain[i], buf);
+		done += count;
+	}
 }
 
 //----------------------------------------------------------------------
@@ -253,57 +726,30 @@ void FileHeader::WriteBack(int sector)
 //	offset in the file) to a physical address (the sector where the
 //	data at the offset is stored).
 //
+//	The whole extent list is in core, so this never touches the disk.
+//
 //	"offset" is the location within the file of the byte in question
 //----------------------------------------------------------------------
 
 int FileHeader::ByteToSector(int offset)
 {
-	// 把 offset 對應的位置找出來
-	FileHeader *fh = new FileHeader;
+	int fileSector = offset / SectorSize;
+	int i = FindExtent(fileSector);
 
-	if (numBytes > MaxFileSize2)
-	{
-		int sector = divRoundDown(offset, MaxFileSize2);
-		fh->FetchFrom(dataSectors[sector]);
-		return fh->ByteToSector(offset - (sector * MaxFileSize2));
-	}
-	else if (numBytes > MaxFileSize1)
-	{
-		int sector = divRoundDown(offset, MaxFileSize1);
-		fh->FetchFrom(dataSectors[sector]);
-		return fh->ByteToSector(offset - (sector * MaxFileSize1));
-	}
-	else if (numBytes > MaxFileSize)
-	{
-		int sector = divRoundDown(offset, MaxFileSize);
-		fh->FetchFrom(dataSectors[sector]);
-		return fh->ByteToSector(offset - (sector * MaxFileSize));
-	}
-	else
-	{
-		return (dataSectors[offset / SectorSize]);
-	}
-	delete fh;
+	if (extents[i].start == -1)
+		return -1;
+	return extents[i].start + (fileSector - extentFirst[i]);
 }
 
+//----------------------------------------------------------------------
+// FileHeader::FileHeaderSize
+// 	Return how many sectors, besides the header sector itself, are
+//	used to describe where the file's data is.
+//----------------------------------------------------------------------
+
 int FileHeader::FileHeaderSize()
 {
-	FileHeader *fh = new FileHeader;
-	int num = 0;
-	if (numBytes > MaxFileSize)
-	{
-		for (int i = 0; i < numSectors; i++)
-		{
-			fh->FetchFrom(dataSectors[i]);
-			num += fh->FileHeaderSize();
-		}
-		return num + numSectors;
-	}
-	else
-	{
-		return 0;
-	}
-	delete fh;
+	return numChain;
 }
 
 //----------------------------------------------------------------------
@@ -328,12 +774,32 @@ void FileHeader::Print()
 	char *data = new char[SectorSize];
 
 	printf("FileHeader contents.  File size: %d.  File blocks:\n", numBytes);
-	for (i = 0; i < numSectors; i++)
-		printf("%d ", dataSectors[i]);
+	if (inlined)
+	{
+		printf("inline\nFile contents:\n");
+		for (j = 0; j < numBytes; j++)
+		{
+			if ('\040' <= inlineData[j] && inlineData[j] <= '\176')
+				printf("%c", inlineData[j]);
+			else
+				printf("\\%x", (unsigned char)inlineData[j]);
+		}
+		printf("\n");
+		delete[] data;
+		return;
+	}
+	for (i = 0; i < numExtents; i++)
+		if (extents[i].start == -1)
+			printf("hole(%d) ", extents[i].length);
+		else
+			printf("%d-%d ", extents[i].start, extents[i].start + extents[i].length - 1);
 	printf("\nFile contents:\n");
 	for (i = k = 0; i < numSectors; i++)
 	{
-		kernel->synchDisk->ReadSector(dataSectors[i], data);
+		if (ByteToSector(i * SectorSize) == -1)
+			memset(data, 0, SectorSize);
+		else
+			kernel->synchDisk->ReadSector(ByteToSector(i * SectorSize), data);
 		for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++)
 		{
 			if ('\040' <= data[j] && data[j] <= '\176') // isprint(data[j])
@@ -345,3 +811,257 @@ void FileHeader::Print()
 	}
 	delete[] data;
 }
+
+//----------------------------------------------------------------------
+// InodeTable::InodeTable
+// 	Initialize an empty table of in-core file headers.
+//
+//	"size" is the number of headers the table can hold
+//----------------------------------------------------------------------
+
+InodeTable::InodeTable(int size)
+{
+	numInodes = size;
+	inodes = new Inode[size];
+	headers = new FileHeader[size];
+	hashTable = new Inode *[size];
+	clockHand = 0;
+	for (int i = 0; i < size; i++)
+	{
+		inodes[i].sector = -1;
+		inodes[i].refCount = 0;
+		inodes[i].dirty = FALSE;
+		inodes[i].deleted = FALSE;
+		inodes[i].referenced = FALSE;
+		inodes[i].hdr = &headers[i];
+		inodes[i].hashNext = NULL;
+		hashTable[i] = NULL;
+	}
+}
+
+//----------------------------------------------------------------------
+// InodeTable::~InodeTable
+// 	De-allocate the table.  Changed headers must already have been
+//	written back by Flush.
+//----------------------------------------------------------------------
+
+InodeTable::~InodeTable()
+{
+	delete[] headers;
+	delete[] inodes;
+	delete[] hashTable;
+}
+
+//----------------------------------------------------------------------
+// InodeTable::Lookup
+// 	Return the entry holding the header at "sector", or NULL.
+//----------------------------------------------------------------------
+
+Inode *InodeTable::Lookup(int sector)
+{
+	Inode *inode;
+
+	for (inode = hashTable[sector % numInodes]; inode != NULL;
+		 inode = inode->hashNext)
+		if (inode->sector == sector)
+			return inode;
+	return NULL;
+}
+
+//----------------------------------------------------------------------
+// InodeTable::Unhash
+// 	Take an entry out of its hash chain.
+//----------------------------------------------------------------------
+
+void InodeTable::Unhash(Inode *inode)
+{
+	Inode **link = &hashTable[inode->sector % numInodes];
+
+	while (*link != inode)
+		link = &(*link)->hashNext;
+	*link = inode->hashNext;
+}
+
+//----------------------------------------------------------------------
+// InodeTable::Slot
+// 	Return an entry for the header at "sector", which is not in the
+//	table, hashed under it.  The CLOCK picks an entry that nobody is
+//	using; the caller fills in the header.
+//----------------------------------------------------------------------
+
+Inode *InodeTable::Slot(int sector)
+{
+	Inode *inode;
+	int scanned;
+
+	// 找一個沒人在用的 entry，兩圈都找不到就是開太多檔案了
+	for (scanned = 0;; scanned++)
+	{
+		ASSERT(scanned < 2 * numInodes);
+		inode = &inodes[clockHand];
+		clockHand = (clockHand + 1) % numInodes;
+		if (inode->refCount > 0)
+			continue;
+		if (!inode->referenced)
+			break;
+		inode->referenced = FALSE;
+	}
+	if (inode->sector != -1)
+	{
+		ASSERT(!inode->dirty); // written back on the last Put
+		Unhash(inode);
+	}
+	inode->sector = sector;
+	inode->hashNext = hashTable[sector % numInodes];
+	hashTable[sector % numInodes] = inode;
+	return inode;
+}
+
+//----------------------------------------------------------------------
+// InodeTable::Get
+// 	Return the in-core header of the file whose header is stored at
+//	"sector", and count one more user of it.  If it is not in the
+//	table, it is read into an entry that nobody is using.
+//----------------------------------------------------------------------
+
+FileHeader *InodeTable::Get(int sector)
+{
+	Inode *inode = Lookup(sector);
+
+	if (inode == NULL)
+	{
+		inode = Slot(sector);
+		inode->hdr->FetchFrom(sector);
+	}
+	inode->refCount++;
+	inode->referenced = TRUE;
+	return inode->hdr;
+}
+
+//----------------------------------------------------------------------
+// InodeTable::GetNew
+// 	Like Get, for a file being created with its header at "sector":
+//	the caller sets up the header, which reaches the disk on the
+//	last Put.  Nothing is read, and whatever the table held for the
+//	sector (an unused header, from before it was freed) is replaced.
+//----------------------------------------------------------------------
+
+FileHeader *InodeTable::GetNew(int sector)
+{
+	Inode *inode = Lookup(sector);
+
+	if (inode == NULL)
+		inode = Slot(sector);
+	ASSERT(inode->refCount == 0);
+	inode->refCount++;
+	inode->referenced = TRUE;
+	inode->dirty = TRUE;
+	return inode->hdr;
+}
+
+//----------------------------------------------------------------------
+// InodeTable::Put
+// 	One user of "hdr" is done with it.  When the last one is, the
+//	sectors the file holds past its end are given back, a changed
+//	header is written back to disk (as an update in the journal), and
+//	the space of a deleted file is freed.  The entry stays in use
+//	until then, so the CLOCK cannot take it while the disk is busy.
+//----------------------------------------------------------------------
+
+void InodeTable::Put(FileHeader *hdr)
+{
+	Inode *inode = Owner(hdr);
+
+	ASSERT(inode->refCount > 0);
+	if (inode->refCount == 1 && inode->deleted)
+	{ // 最後一個人關掉了，現在才能放掉空間
+		kernel->fileSystem->Free(hdr, inode->sector);
+		inode->deleted = FALSE;
+		inode->sector = -1;
+		inode->referenced = FALSE;
+	}
+	else if (inode->refCount == 1)
+	{
+		if (hdr->MappedSectors() > divRoundUp(hdr->FileLength(), SectorSize))
+			kernel->fileSystem->Release(hdr); // 沒用到的預留空間還回去
+		if (inode->dirty)
+		{
+			inode->dirty = FALSE;
+			kernel->synchDisk->BeginUpdate();
+			inode->hdr->WriteBack(inode->sector);
+			kernel->synchDisk->EndUpdate();
+		}
+	}
+	inode->refCount--;
+}
+
+//----------------------------------------------------------------------
+// InodeTable::SetDirty
+// 	Note that "hdr" differs from the disk.  The header of a deleted
+//	file is never written back.
+//----------------------------------------------------------------------
+
+void InodeTable::SetDirty(FileHeader *hdr)
+{
+	Inode *inode = Owner(hdr);
+
+	ASSERT(inode->refCount > 0);
+	if (!inode->deleted)
+		inode->dirty = TRUE;
+}
+
+//----------------------------------------------------------------------
+// InodeTable::WriteBack
+// 	Write "hdr" back now, if it has changed, instead of on the last
+//	Put: the caller is in an update that changed the free map for
+//	it, and the two must reach the log together.
+//----------------------------------------------------------------------
+
+void InodeTable::WriteBack(FileHeader *hdr)
+{
+	Inode *inode = Owner(hdr);
+
+	ASSERT(inode->refCount > 0);
+	if (inode->dirty)
+	{
+		inode->dirty = FALSE;
+		hdr->WriteBack(inode->sector);
+	}
+}
+
+//----------------------------------------------------------------------
+// InodeTable::Forget
+// 	Like Put, for a file that has just been deleted: its header is
+//	never written back, and it leaves the hash table at once.  The
+//	file system frees its space on the last Put, which is this one
+//	unless the file is still open.
+//----------------------------------------------------------------------
+
+void InodeTable::Forget(FileHeader *hdr)
+{
+	Inode *inode = Owner(hdr);
+
+	ASSERT(inode->refCount > 0 && !inode->deleted);
+	inode->dirty = FALSE;
+	inode->deleted = TRUE;
+	Unhash(inode);
+	Put(hdr);
+}
+
+//----------------------------------------------------------------------
+// InodeTable::Flush
+// 	Write back every changed header, including those of files that
+//	are still open.  Called when Nachos halts.
+//----------------------------------------------------------------------
+
+void InodeTable::Flush()
+{
+	kernel->synchDisk->BeginUpdate();
+	for (int i = 0; i < numInodes; i++)
+		if (inodes[i].sector != -1 && inodes[i].dirty)
+		{
+			inodes[i].hdr->WriteBack(inodes[i].sector);
+			inodes[i].dirty = FALSE;
+		}
+	kernel->synchDisk->EndUpdate();
+}
@@ -17,23 +17,42 @@
 #include "disk.h"
 #include "pbitmap.h"
 
-#define NumDirect ((SectorSize - 2 * sizeof(int)) / sizeof(int))
-#define MaxFileSize (NumDirect * SectorSize) // level 0 (30 * 128)
+// An extent is a run of "length" consecutive disk sectors starting at
+// sector "start".  The data of a file is described by a list of extents,
+// in file order.  An extent whose start is -1 is a hole: that part of
+// the file has no sectors yet, and reads as zeros.
 
-// 定義好個別的 filesize 知道這個 file 需要幾層 fileheader
-#define MaxFileSize1 (MaxFileSize * NumDirect) // level 1 (30 * 30 * 128)
-#define MaxFileSize2 (MaxFileSize * NumDirect * NumDirect) // level 2 (30 * 30 * 30 * 128)
+class Extent
+{
+public:
+	int start;	// First disk sector of the run, -1 for a hole
+	int length; // Number of sectors in the run
+};
+
+// 一個 header sector 前面放 4 個 int，剩下的空間都拿來放 extent
+#define NumHeaderFields 4
+#define NumExtents ((SectorSize - NumHeaderFields * sizeof(int)) / sizeof(Extent)) // 14 extents in the header
+
+// 放不下的 extent 接到 chain sector，每個 chain sector 開頭是 next 跟 count
+#define NumChainExtents ((SectorSize - 2 * sizeof(int)) / sizeof(Extent)) // 15 extents per chain sector
+
+// 很小的檔案直接把資料放在 header 裡原本放 extent 的地方
+#define MaxInlineBytes ((int)(NumExtents * sizeof(Extent))) // 112 bytes
 
 // The following class defines the Nachos "file header" (in UNIX terms,
 // the "i-node"), describing where on disk to find all of the data in the file.
-// The file header is organized as a simple table of pointers to
-// data blocks.
+// The file header is organized as a list of extents.  The first NumExtents
+// extents live in the header sector itself; if a file needs more, they
+// spill into a chain of extra sectors, each holding NumChainExtents more.
+//
+// A file of at most MaxInlineBytes that has no data sectors keeps its
+// data inline, in the header sector where the extents would go; it is
+// moved out to a data sector when it grows past that.
 //
 // The file header data structure can be stored in memory or on disk.
-// When it is on disk, it is stored in a single sector -- this means
-// that we assume the size of this data structure to be the same
-// as one disk sector.  Without indirect addressing, this
-// limits the maximum file length to just under 4K bytes.
+// When it is on disk, it is stored in a single sector (plus its chain).
+// In memory, the whole extent list is kept in one array, so that mapping
+// a file offset to a disk sector never touches the disk.
 //
 // There is no constructor; rather the file header can be initialized
 // by allocating blocks for the file (if it is a new file), or by
@@ -49,8 +68,25 @@ public:
 	bool Allocate(PersistentBitmap *bitMap, int fileSize); // Initialize a file header,
 														   //  including allocating space
 														   //  on disk for the file data
+	void AllocateSparse(int fileSize);					   // Initialize a file header
+														   //  for a file that is all
+														   //  hole (or inline zeros)
 	void Deallocate(PersistentBitmap *bitMap);			   // De-allocate this file's
 														   //  data blocks
+	bool Extend(PersistentBitmap *bitMap, int newSize);	   // Allocate more data
+														   //  blocks, so the file
+														   //  is "newSize" bytes
+	bool Reserve(PersistentBitmap *bitMap, int wanted,
+				 int dataStart = 0);					   // Allocate data blocks
+														   //  for the file to
+														   //  grow into
+	bool Fill(PersistentBitmap *bitMap, int first, int count); // Allocate
+														   //  blocks for the holes
+														   //  among some sectors
+	bool HasHole(int first, int last);					   // Are any of these
+														   //  sectors a hole?
+	void ReleaseTail(PersistentBitmap *bitMap);			   // Free the blocks
+														   //  past the end
 
 	void FetchFrom(int sectorNumber); // Initialize file header from disk
 	void WriteBack(int sectorNumber); // Write modifications to file header
@@ -58,12 +94,25 @@ public:
 
 	int ByteToSector(int offset); // Convert a byte offset into the file
 								  // to the disk sector containing
-								  // the byte
+								  // the byte (-1 in a hole)
 
 	int FileLength(); // Return the length of the file
 					  // in bytes
-
-	int FileHeaderSize();
+	void SetLength(int length); // Change it, within the
+								// sectors already allocated
+	int MappedSectors();	// Data sectors the extents cover,
+							// holes and any past the end included
+
+	int FileHeaderSize(); // Number of chain sectors holding extents
+						  // that do not fit in the header sector
+
+	bool IsInline() { return inlined; } // Is the data in the header?
+	void ReadInline(char *into, int numBytes, int position);
+	void WriteInline(char *from, int numBytes, int position);
+									// Move inline data; a write
+									// may make the file longer
+	void MoveInline(char *into);	// Copy the inline data out, and
+									// make the file a hole instead
 
 	void Print(); // Print the contents of the file.
 
@@ -76,17 +125,109 @@ private:
 		In-core part are data only lies in memory, and are used to maintain the data structure of this class.
 		In order to implement a data structure, you will need to add some "in-core" data
 		to maintain data structure.
-		
-		Disk Part - numBytes, numSectors, dataSectors occupy exactly 128 bytes and will be
-		written to a sector on disk.
-		In-core part - none
-		
+
+		Disk Part - numBytes, numSectors, numExtents, chainSector and the first
+		NumExtents entries of extents occupy exactly 128 bytes and will be
+		written to a sector on disk.  The rest of extents goes to the chain.
+		For an inline file, numExtents is -1 on disk and the data takes
+		the place of the extents.
+		numSectors can be more than numBytes needs: a growing file holds
+		some sectors past its end until it is closed.  It counts the
+		sectors of holes too.
+		In-core part - extents (the whole list), extentFirst, chain, inlined
+
 	*/
 
-	int numBytes;				// Number of bytes in the file
-	int numSectors;				// Number of data sectors in the file
-	int dataSectors[NumDirect]; // Disk sector numbers for each data
-								// block in the file
+	int numBytes;	 // Number of bytes in the file
+	int numSectors;	 // Number of data sectors in the file
+	int numExtents;	 // Number of extents describing the data
+	int chainSector; // First chain sector, -1 if there is none
+
+	Extent *extents;	// All extents of the file, in file order
+	int *extentFirst;	// extentFirst[i] is the file sector where
+						// extents[i] begins
+	int extentCapacity; // Allocated size of extents/extentFirst
+	int *chain;			// Chain sectors, in order
+	int numChain;		// Number of chain sectors
+	bool inlined;		// Data kept in the header?
+	char inlineData[MaxInlineBytes]; // ... here; zeros past numBytes
+
+	void AddExtent(int start, int length); // Append a run to the list,
+										   // merging with the last one
+										   // when they are contiguous
+	bool ReserveChain(PersistentBitmap *freeMap); // Allocate enough chain
+												  // sectors for the list
+	int FindExtent(int fileSector); // Index of the extent holding
+									// "fileSector" (binary search)
+	void Shrink(PersistentBitmap *freeMap, int keep); // Free all but
+													  // the first "keep"
+													  // data sectors
+	void MapRun(int fileSector, int start, int length); // Put a run of
+														 // disk sectors
+														 // in a hole
+};
+
+// Number of file headers the inode table keeps in memory.
+#define NumInodes 128
+
+// The following class defines one entry of the inode table.
+
+class Inode
+{
+public:
+	int sector;		  // Where the header lives on disk, -1 if unused
+	int refCount;	  // Number of OpenFiles using the header
+	bool dirty;		  // Changed since it was read or written?
+	bool deleted;	  // File removed?  Then it is out of the
+					  // hash table, is never written back, and
+					  // is freed on the last Put
+	bool referenced;  // Used since the clock hand last passed?
+	FileHeader *hdr;  // The header itself
+	Inode *hashNext;  // Next entry in the same hash bucket
+};
+
+// The following class defines the system-wide table of file headers
+// in memory (in UNIX terms, the in-core inode table).  Every OpenFile
+// for the same file shares one FileHeader, found by hashing the sector
+// of the header.  A changed header is written back when the last
+// OpenFile using it is closed; headers nobody uses stay in the table,
+// so opening the file again does not read the disk, until the CLOCK
+// picks them for reuse.
+
+class InodeTable
+{
+public:
+	InodeTable(int size); // Initialize an empty table of "size" headers
+	~InodeTable();		  // De-allocate the table
+
+	FileHeader *Get(int sector); // Header stored at "sector", read from
+								 // disk if it is not in the table;
+								 // one more reference
+	FileHeader *GetNew(int sector); // Same, for a header that is being
+									// created there: not read, and
+									// marked changed
+	void Put(FileHeader *hdr);		// Drop a reference; if it was the
+									// last, write the header back, or
+									// free the file if it was deleted
+	void SetDirty(FileHeader *hdr); // The header has changed
+	void WriteBack(FileHeader *hdr); // Write it now if it changed,
+									 // as part of an update
+	void Forget(FileHeader *hdr);	// Drop a reference to the header of
+									// a deleted file, without writing it
+	void Flush();				 // Write back every changed header
+
+private:
+	int numInodes;		// Size of the table
+	Inode *inodes;		// The entries
+	FileHeader *headers; // Their headers; inodes[i] has headers[i]
+	Inode **hashTable;	// Entries hashed by sector
+	int clockHand;		// Next entry the CLOCK looks at
+
+	Inode *Lookup(int sector); // Find the entry for a sector
+	Inode *Owner(FileHeader *hdr) { return &inodes[hdr - headers]; }
+							   // ... or for a header
+	Inode *Slot(int sector);   // Take an unused entry for a sector
+	void Unhash(Inode *inode); // Take an entry out of the hash table
 };
 
 #endif // FILEHDR_H
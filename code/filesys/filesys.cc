@@ -19,7 +19,9 @@
 //	on bootup.
 //
 //	The file system assumes that the bitmap and directory files are
-//	kept "open" continuously while Nachos is running.
+//	kept "open" continuously while Nachos is running.  The bitmap
+//	itself is also kept in memory, and only the sectors of it that
+//	an operation changed are written back.
 //
 //	For those operations (such as Create, Remove) that modify the
 //	directory and/or bitmap, if the operation succeeds, the changes
@@ -28,16 +30,17 @@
 //	modified part of the directory and/or bitmap, we simply discard
 //	the changed version, without writing it back to disk.
 //
-// 	Our implementation at this point has the following restrictions:
+//	Each such operation is one update in the journal (cf. synchdisk.h):
+//	the metadata sectors it writes are first appended to a log region
+//	next to the bitmap and directory headers, together with those of
+//	other recent operations, and only then go to their places on disk.
+//	If Nachos stops in the middle, the log is replayed at the next
+//	boot, so an operation is either all there or not at all.  File
+//	data is not logged.
 //
-//	   there is no synchronization for concurrent accesses
-//	   files have a fixed size, set when the file is created
-//	   files cannot be bigger than about 3KB in size
-//	   there is no hierarchical directory structure, and only a limited
-//	     number of files can be added to the system
-//	   there is no attempt to make the system robust to failures
-//	    (if Nachos exits in the middle of an operation that modifies
-//	    the file system, it may corrupt the disk)
+//	Operations on the free map and the directories hold one lock,
+//	so they do not interleave while one of them waits for the disk.
+//	File data is not covered by it.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -47,10 +50,12 @@
 #include "copyright.h"
 #include "debug.h"
 #include "disk.h"
+#include "synchdisk.h"
 #include "pbitmap.h"
 #include "directory.h"
 #include "filehdr.h"
 #include "filesys.h"
+#include "main.h"
 
 // Sectors containing the file headers for the bitmap of free sectors,
 // and the directory of files.  These file headers are placed in well-known
@@ -58,16 +63,51 @@
 #define FreeMapSector 0
 #define DirectorySector 1
 
-// Initial file sizes for the bitmap and directory; until the file system
-// supports extensible files, the directory size sets the maximum number
-// of files that can be loaded onto the disk.
+// The journal takes up the sectors right after those two.
+#define JournalSector 2
+#define JournalSectors 1024
+
+// Files removed and not yet reclaimed are listed in the sector after
+// the journal: a count, then the header sector of each and whether it
+// is a directory.  The list changes in the same update as the
+// directory, so a crash never leaves their space with nothing
+// pointing at it.
+#define OrphanSector (JournalSector + JournalSectors)
+#define MaxOrphans ((int)((SectorSize / sizeof(int) - 1) / 2))
+
+// Initial file sizes for the bitmap and directory.  A directory starts
+// out as a header sector and one bucket, and grows as files are added.
 
 // bit 變成 byte
 #define FreeMapFileSize (NumSectors / BitsInByte)
-// file 最多只能放 10 個
-#define NumDirEntries 10
-// 所有 file entry 的資料
-#define DirectoryFileSize (sizeof(DirectoryEntry) * NumDirEntries)
+// header 跟第一個 bucket
+#define DirectoryFileSize (2 * SectorSize)
+
+// Number of path components kept in the name cache.
+#define NameCacheSize 512
+
+// Files with more data sectors than this get their data in an empty
+// track group, rather than filling up the group of their directory.
+#define LargeFileSectors (SectorsPerGroup / 2)
+
+// One directory on the way down a tree walk: a copy of its entries,
+// and how many of them have been visited.
+class WalkFrame
+{
+public:
+    DirectoryEntry *entries;
+    int count;
+    int next;
+};
+
+// A file or directory that has been removed from its directory, and
+// whose space the reclaimer has yet to free.
+class Orphan
+{
+public:
+    int sector;  // Its header
+    bool isDir;  // A directory, with everything below it?
+};
 
 //----------------------------------------------------------------------
 // FileSystem::FileSystem
@@ -76,8 +116,12 @@
 //	an empty directory, and a bitmap of free sectors (with almost but
 //	not all of the sectors marked as free).
 //
+//	Formatting starts by erasing the disk, so only the sectors that
+//	are not all zeros are written, and it takes no simulated time.
+//
 //	If format = FALSE, we just have to open the files
-//	representing the bitmap and the directory.
+//	representing the bitmap and the directory, and pick up the
+//	removed files whose space was not reclaimed yet.
 //
 //	"format" -- should we initialize the disk?
 //----------------------------------------------------------------------
@@ -85,10 +129,17 @@
 FileSystem::FileSystem(bool format)
 {
     DEBUG(dbgFile, "Initializing the file system.");
+    nameCache = new DentryCache(NameCacheSize);
+    fsLock = new Lock("file system");
+    orphans = new ::List<Orphan *>;
+    reclaimWanted = NULL;
+    if (format)
+        kernel->synchDisk->StartFormat();
+    kernel->synchDisk->StartJournal(JournalSector, JournalSectors, format);
     if (format)
     {
-        PersistentBitmap *freeMap = new PersistentBitmap(NumSectors);
-        Directory *directory = new Directory(NumDirEntries);
+        freeMap = new PersistentBitmap(NumSectors);
+        Directory *directory = new Directory;
         FileHeader *mapHdr = new FileHeader;
         FileHeader *dirHdr = new FileHeader;
 
@@ -98,6 +149,9 @@ FileSystem::FileSystem(bool format)
         // (make sure no one else grabs these!)
         freeMap->Mark(FreeMapSector);
         freeMap->Mark(DirectorySector);
+        for (int i = 0; i < JournalSectors; i++)
+            freeMap->Mark(JournalSector + i);
+        freeMap->Mark(OrphanSector); // 清空的 disk 上就是空的 list
 
         // Second, allocate space for the data blocks containing the contents
         // of the directory and bitmap files.  There better be enough space!
@@ -129,6 +183,7 @@ FileSystem::FileSystem(bool format)
         // to hold the file data for the directory and bitmap.
 
         DEBUG(dbgFile, "Writing bitmap and directory back to disk.");
+        freeMap->OnZeroedDisk();
         freeMap->WriteBack(freeMapFile); // flush changes to disk
         directory->WriteBack(directoryFile);
 
@@ -137,17 +192,20 @@ FileSystem::FileSystem(bool format)
             freeMap->Print();
             directory->Print();
         }
-        delete freeMap;
         delete directory;
         delete mapHdr;
         delete dirHdr;
+        kernel->synchDisk->EndFormat();
     }
     else
     {
         // if we are not formatting the disk, just open the files representing
-        // the bitmap and directory; these are left open while Nachos is running
+        // the bitmap and directory; these are left open while Nachos is running,
+        // and the bitmap is read into memory once
         freeMapFile = new OpenFile(FreeMapSector);
         directoryFile = new OpenFile(DirectorySector);
+        freeMap = new PersistentBitmap(freeMapFile, NumSectors);
+        ReadOrphans();
     }
 }
 
@@ -157,34 +215,38 @@ FileSystem::FileSystem(bool format)
 //----------------------------------------------------------------------
 FileSystem::~FileSystem()
 {
-    delete freeMapFile;
-    delete directoryFile;
+    delete directoryFile; // the last close may give sectors back,
+    delete freeMapFile;   // so these go while the free map is there
+    delete nameCache;
+    delete orphans;
+    delete fsLock;
+    delete reclaimWanted;
+    delete freeMap;
 }
 
 //----------------------------------------------------------------------
 // FileSystem::Create
 // 	Create a file in the Nachos file system (similar to UNIX create).
-//	Since we can't increase the size of files dynamically, we have
-//	to give Create the initial size of the file.
+//	Files grow when they are written past the end, but we can
+//	give Create the initial size of the file.  No data blocks are
+//	allocated for it: the file starts out as a hole, and each part
+//	gets its blocks when it is first written.
 //
 //	The steps to create a file are:
 //	  Make sure the file doesn't already exist
 //        Allocate a sector for the file header
-// 	  Allocate space on disk for the data blocks for the file
 //	  Add the name to the directory
 //	  Store the new file header on disk
 //	  Flush the changes to the bitmap and the directory back to disk
+//	All but the first step are one update in the journal.
 //
 //	Return TRUE if everything goes ok, otherwise, return FALSE.
 //
 // 	Create fails if:
 //   		file is already in directory
 //	 	no free space for file header
-//	 	no free entry for file in directory
-//	 	no free space for data blocks for the file
-//
-// 	Note that this implementation assumes there is no concurrent access
-//	to the file system!
+//	 	no free entry for file in directory, and no free space
+//		for the directory to grow
 //
 //	"name" -- name of file to be created
 //	"initialSize" -- size of file to be created
@@ -193,46 +255,52 @@ FileSystem::~FileSystem()
 int FileSystem::Create(char *name, int initialSize)
 {
     Directory *directory;
-    PersistentBitmap *freeMap;
-    OpenFile *dirFile = directoryFile;
+    OpenFile *dirFile;
     FileHeader *hdr;
-    pair<int, int> temp;
+    char fileName[FileNameMaxLen + 1];
     int sector, isDir;
+    int dirSector; // header of the directory we are in
     int fileHeaderSize;
     int totalsize;
-    char *fileName;
 
     DEBUG(dbgFile, "Creating file " << name << " size " << initialSize);
     DEBUG(alice, "Creating file " << name << " size " << initialSize);
 
-    directory = new Directory(NumDirEntries);
-    directory->FetchFrom(directoryFile);
+    fsLock->Acquire();
+    if (Lookup(name, &dirSector, &isDir, fileName) != -1 || dirSector == -1)
+    {
+        fsLock->Release();
+        return 0; // file already exists, or its directory does not
+    }
+    DEBUG(alice, fileName << " is not exist, create this!");
 
-    fileName = strtok(name, "/");
-    while(fileName != NULL) {
-        temp = directory->Find(fileName);
-        sector = temp.first;
-        isDir = temp.second;
-        if (sector != -1 && isDir == 1) { // 這層dir存在，要繼續往下走
-            DEBUG(alice, fileName << " is dir, keep going");
-            dirFile = new OpenFile(sector);
-            directory->FetchFrom(dirFile);
-        }
-        else { // 這層dir不存在，所以就是要create的file
-            //ASSERT (isDir == -1); // 這個檔案若已經存在，則會assertion fail
-            DEBUG(alice, fileName << " is not exist, create this!");
-            break;
+    kernel->synchDisk->BeginUpdate();
+    dirFile = OpenDirectory(dirSector);
+    directory = new Directory;
+    directory->FetchFrom(dirFile);
+    if (kernel->trackGroups)
+        freeMap->PlaceNear(dirSector); // keep the header near its directory
+    sector = freeMap->FindAndSet(); // find a sector to hold the file header
+    if (sector < 0 || !directory->Add(fileName, sector, false, freeMap))
+    { // disk 滿了
+        if (sector >= 0)
+        {
+            freeMap->Clear(sector);
+            kernel->synchDisk->Revoke(sector);
         }
-        fileName = strtok(NULL, "/");
+        freeMap->WriteBack(freeMapFile);
+        delete directory;
+        CloseDirectory(dirFile);
+        kernel->synchDisk->EndUpdate();
+        fsLock->Release();
+        return 0;
     }
-    freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-    sector = freeMap->FindAndSet(); // find a sector to hold the file header
-    ASSERT(sector >= 0);
-    ASSERT(directory->Add(fileName, sector, false));
+    nameCache->Enter(dirSector, fileName, sector, 0);
     DEBUG(alice, "success add to directory");
-    hdr = new FileHeader;
-    ASSERT(hdr->Allocate(freeMap, initialSize));
-    DEBUG(alice, "success allocate space");
+    hdr = kernel->inodeTable->GetNew(sector); // 舊的 header 可能還在 table 裡
+    if (kernel->trackGroups && divRoundUp(initialSize, SectorSize) > LargeFileSectors)
+        freeMap->PlaceLarge(); // small files follow the header, when written
+    hdr->AllocateSparse(initialSize);
 
     // if we want to know this file header size
     fileHeaderSize = hdr->FileHeaderSize() + 1;
@@ -240,60 +308,76 @@ int FileSystem::Create(char *name, int initialSize)
     DEBUG(size, "file size = " << initialSize << "   file header number = " << fileHeaderSize << "   total file header size = " << totalsize << " KB");
     
     // everthing worked, flush all changes back to disk
-    hdr->WriteBack(sector);
-    directory->WriteBack(dirFile); // directoryFile是root directory，dirFil才是這一層的directory
+    kernel->inodeTable->Put(hdr); // writes the header back
+    directory->WriteBack(dirFile); // dirFile是這一層的directory
     freeMap->WriteBack(freeMapFile);
     DEBUG(alice, "write back finish, create file success");
-    delete hdr;
-    delete freeMap;
     delete directory;
+    CloseDirectory(dirFile);
+    kernel->synchDisk->EndUpdate();
+    fsLock->Release();
     return 1;
 }
 
 void FileSystem::CreateDirectory(char *name)
 {
     Directory *directory;
-    PersistentBitmap *freeMap;
-    OpenFile *dirFile = directoryFile;
-    FileHeader *newDirHdr = new FileHeader;
-    pair<int, int> temp;
-    int sector;
-    char *dirname;
-
-    directory = new Directory(NumDirEntries);
-    directory->FetchFrom(directoryFile);
+    OpenFile *dirFile;
+    FileHeader *newDirHdr;
+    char dirname[FileNameMaxLen + 1];
+    int sector, isDir;
+    int dirSector; // header of the parent directory
 
-    dirname = strtok(name, "/");
-    while(dirname != NULL) {
-        temp = directory->Find(dirname);
-        sector = temp.first;
-        if (sector != -1) { // 這層dir存在，要繼續往下走
-            dirFile = new OpenFile(sector);
-            directory->FetchFrom(dirFile);
-        }
-        else { // 這層dir不存在，所以就是要create的dir
-            break;
-        }
-        dirname = strtok(NULL, "/");
+    fsLock->Acquire();
+    if (Lookup(name, &dirSector, &isDir, dirname) != -1 || dirSector == -1)
+    {
+        printf("CreateDirectory: couldn't create %s\n", name);
+        fsLock->Release();
+        return;
     }
-    freeMap = new PersistentBitmap(freeMapFile, NumSectors);
+
+    kernel->synchDisk->BeginUpdate();
+    dirFile = OpenDirectory(dirSector);
+    directory = new Directory;
+    directory->FetchFrom(dirFile);
+    if (kernel->trackGroups)
+        freeMap->PlaceDirectory(dirSector); // spread directories out
     sector = freeMap->FindAndSet(); // find a sector to hold the dir header
-    ASSERT(sector >= 0);
-    ASSERT(directory->Add(dirname, sector, true)); // 把新的dir加到現在的directory底下
-    ASSERT(newDirHdr->Allocate(freeMap, DirectoryFileSize)); //幫新的dir（data的部分) allocate空間
-    newDirHdr->WriteBack(sector); // 把新的sub dir header寫回disk
+    if (sector >= 0)
+    {
+        newDirHdr = kernel->inodeTable->GetNew(sector);
+        if (!newDirHdr->Allocate(freeMap, DirectoryFileSize) || //幫新的dir（data的部分) allocate空間
+            !directory->Add(dirname, sector, true, freeMap))    // 把新的dir加到現在的directory底下
+        { // 已經拿到的都還回去；Forget 會放掉 header 跟 data
+            kernel->inodeTable->Forget(newDirHdr);
+            sector = -1;
+        }
+    }
+    if (sector < 0)
+    { // disk 滿了
+        printf("CreateDirectory: couldn't create %s\n", name);
+        freeMap->WriteBack(freeMapFile);
+        delete directory;
+        CloseDirectory(dirFile);
+        kernel->synchDisk->EndUpdate();
+        fsLock->Release();
+        return;
+    }
+    nameCache->Enter(dirSector, dirname, sector, 1);
+    kernel->inodeTable->Put(newDirHdr); // 把新的sub dir header寫回disk
     OpenFile *newDirFile = new OpenFile(sector); // 打開新的sub dir的檔案
-    Directory *newDir = new Directory(NumDirEntries); //爲sub dir創建新的directory structure
+    Directory *newDir = new Directory; //爲sub dir創建新的directory structure
     newDir->WriteBack(newDirFile); // 把這個新的directory structure寫進sub dir的檔案中
     directory->WriteBack(dirFile); // 更新舊的（上一層）dir的結構
     freeMap->WriteBack(freeMapFile); // 更新free map
 
     //把過程中產生的變數刪掉
-    delete newDirHdr;
     delete newDirFile;
     delete newDir;
-    delete freeMap;
     delete directory;
+    CloseDirectory(dirFile);
+    kernel->synchDisk->EndUpdate();
+    fsLock->Release();
 }
 
 //----------------------------------------------------------------------
@@ -308,38 +392,21 @@ void FileSystem::CreateDirectory(char *name)
 
 OpenFile * FileSystem::Open(char *name)
 {
-    Directory *directory = new Directory(NumDirEntries);
     OpenFile *openFile = NULL;
-    pair<int, int> temp;
-    int sector, isDir;
-    char *fileName;
+    char fileName[FileNameMaxLen + 1];
+    int sector, dirSector, isDir;
 
     DEBUG(dbgFile, "Opening file" << name);
     DEBUG(alice, "opening file: " << name);
-    directory->FetchFrom(directoryFile);
 
-    fileName = strtok(name, "/");
-    while(fileName != NULL) {
-        temp = directory->Find(fileName);
-        sector = temp.first;
-        isDir = temp.second;
-        ASSERT(sector != -1);
-        if (isDir) { // 這層dir存在，要繼續往下走
-            DEBUG(alice, fileName << " is dir, keep going");
-            openFile = new OpenFile(sector);
-            directory->FetchFrom(openFile);
-        }
-        else {
-            DEBUG(alice, fileName << " is file, open this one!");
-            break;
-        }
-        fileName = strtok(NULL, "/");
+    fsLock->Acquire();
+    sector = Lookup(name, &dirSector, &isDir, fileName);
+    if (sector != -1)
+    {
+        openFile = new OpenFile(sector); // name was found in directory
+        DEBUG(alice, "success open file");
     }
-
-    openFile = new OpenFile(sector); // name was found in directory
-    DEBUG(alice, "success open file");
-    curFile = openFile;
-    delete directory;
+    fsLock->Release();
 
     return openFile; // return NULL if not found
 }
@@ -351,6 +418,15 @@ OpenFile * FileSystem::Open(char *name)
 //	    Delete the space for its header
 //	    Delete the space for its data blocks
 //	    Write changes to directory, bitmap back to disk
+//	as one update in the journal.
+//
+//	Once StartReclaimer has been called, only the name is removed
+//	here.  The file is queued for the reclaimer, which frees its
+//	space later; until then the sectors stay marked in the free map,
+//	so nothing else can be put there.  The queue is written to disk
+//	in the same update; if it is full, the space is freed here after
+//	all.  Either way, the space of a file that is still open is only
+//	freed when it is last closed.
 //
 //	Return TRUE if the file was deleted, FALSE if the file wasn't
 //	in the file system.
@@ -361,115 +437,565 @@ OpenFile * FileSystem::Open(char *name)
 bool FileSystem::Remove(char *name, bool recursive)
 {
     Directory *directory;
-    PersistentBitmap *freeMap;
     FileHeader *fileHdr;
-    OpenFile *openFile, *prevFile; // prevFile紀錄前一個directory的file
-    pair<int, int> temp;
-    int sector, isDir;
-    int isFile = 0; // -rr 可能也要刪掉 file
-    char *deleteName, *prevName;
-
-    openFile = directoryFile;
-    directory = new Directory(NumDirEntries);
-    directory->FetchFrom(directoryFile);
+    OpenFile *dirFile;
+    Orphan *orphan;
+    char deleteName[FileNameMaxLen + 1];
+    int sector, dirSector, isDir;
+    bool queued;
 
     DEBUG(alice, "remove file: " << name);
 
-    deleteName = strtok(name, "/");
-    while(deleteName != NULL) {
-        temp = directory->Find(deleteName);
-        DEBUG(alice, "check here");
-        sector = temp.first;
-        isDir = temp.second;
-        ASSERT(sector != -1);
-        DEBUG(alice, "check assertion");
-        if (isDir) {
-            DEBUG(alice, "in directory: " << deleteName << ", keep going!");
-            prevFile = openFile;
-            prevName = deleteName;
-            openFile = new OpenFile(sector);
-            directory->FetchFrom(openFile);
-        }
-        else {
-            DEBUG(alice, "find target file: " << deleteName << ", start delete!");
-            prevFile = openFile;
-            prevName = deleteName;
-            isFile = 1;
-            break;
-        }
-        deleteName = strtok(NULL, "/");
+    fsLock->Acquire();
+    sector = Lookup(name, &dirSector, &isDir, deleteName);
+    if (sector == -1 || dirSector == -1)
+    {
+        fsLock->Release();
+        return FALSE; // no such file, or it is the root
     }
+    DEBUG(alice, "find target: " << deleteName << ", start delete!");
 
-    freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-
-    if (recursive) {
-        if (!isFile) {
-            directory->RecursiveRemove(freeMap);
-        }
-        directory->FetchFrom(prevFile); // 取得要被刪掉的這個資料夾的上一層的directory
-        openFile = prevFile; // 取得上一層資料夾的file
-        deleteName = prevName; // 取回要被刪掉的資料夾名稱
+    kernel->synchDisk->BeginUpdate();
+    queued = (reclaimWanted != NULL && (int)orphans->NumInList() < MaxOrphans);
+    if (queued)
+    { // 空間留給 reclaimer 去放
+        orphan = new Orphan;
+        orphan->sector = sector;
+        orphan->isDir = (recursive && isDir == 1);
+        orphans->Append(orphan);
+        WriteOrphans();
+    }
+    else
+    {
+        if (recursive && isDir == 1)
+            WalkTree(sector, TRUE); // 刪掉這個資料夾底下的東西
+        fileHdr = kernel->inodeTable->Get(sector); // get the file header
+        kernel->inodeTable->Forget(fileHdr); // remove header and data blocks
     }
 
-    fileHdr = new FileHeader;
-    fileHdr->FetchFrom(sector); // get the file header
-    fileHdr->Deallocate(freeMap); // remove data blocks
-    freeMap->Clear(sector);       // remove header block
+    dirFile = OpenDirectory(dirSector);
+    directory = new Directory;
+    directory->FetchFrom(dirFile);
     directory->Remove(deleteName);
+    if (isDir == 1)
+        nameCache->Purge(); // names below it are gone too
+    nameCache->Enter(dirSector, deleteName, -1, -1);
 
     freeMap->WriteBack(freeMapFile);     // flush to disk
     DEBUG(alice, "writeback");
-    directory->WriteBack(openFile); // flush to disk
+    directory->WriteBack(dirFile); // flush to disk
     
-    delete fileHdr;
     delete directory;
-    delete freeMap;
+    CloseDirectory(dirFile);
+    kernel->synchDisk->EndUpdate();
+    fsLock->Release();
+    if (queued)
+        reclaimWanted->V();
     return TRUE;
 }
 
+//----------------------------------------------------------------------
+// FileSystem::StartReclaimer
+// 	Fork the reclaimer: a thread that frees the space of removed
+//	files in the background, so that Remove returns as soon as the
+//	name is gone.  Removing a large file otherwise means reading all
+//	of its extents and clearing a bit for each of its sectors first.
+//	Files left queued on disk by a crash are its first work.
+//----------------------------------------------------------------------
+
+void ReclaimerThread(void *arg)
+{
+    FileSystem *fileSystem = (FileSystem *)arg;
+
+    for (;;)
+    {
+        fileSystem->reclaimWanted->P();
+        fileSystem->Reclaim();
+    }
+}
+
+void FileSystem::StartReclaimer()
+{
+    Thread *t;
+
+    reclaimWanted = new Semaphore("reclaimer", 0);
+    if (!orphans->IsEmpty())
+        reclaimWanted->V();
+    t = new Thread("reclaimer", -1);
+    t->Fork((VoidFunctionPtr)ReclaimerThread, (void *)this);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Reclaim
+// 	Free the space of every file removed so far, in one update, with
+//	one write of the changed parts of the free map at the end.  Run
+//	by the reclaimer, each time something is removed, and by
+//	Interrupt::Halt, so that nothing stays allocated on disk
+//	with no name pointing at it.  A file that is still open is left
+//	to its last close.  The list on disk is emptied in the same
+//	update.
+//
+//	Without the reclaimer, Remove frees space itself, and the only
+//	files here are those a crash left queued on disk.
+//----------------------------------------------------------------------
+
+void FileSystem::Reclaim()
+{
+    Orphan *orphan;
+    FileHeader *fileHdr;
+    int count = 0;
+
+    fsLock->Acquire();
+    if (!orphans->IsEmpty())
+    {
+        kernel->synchDisk->BeginUpdate();
+        while (!orphans->IsEmpty())
+        { // 放的時候可能又有新的被 Remove，一起處理
+            orphan = orphans->RemoveFront();
+            if (orphan->isDir)
+                WalkTree(orphan->sector, TRUE);
+            fileHdr = kernel->inodeTable->Get(orphan->sector);
+            kernel->inodeTable->Forget(fileHdr);
+            delete orphan;
+            count++;
+        }
+        WriteOrphans();
+        freeMap->WriteBack(freeMapFile);
+        kernel->synchDisk->EndUpdate();
+        DEBUG(dbgFile, "Reclaimed the space of " << count << " removed files");
+    }
+    fsLock->Release();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::WriteOrphans
+// 	Write the queue of removed files to OrphanSector.  Called in the
+//	update that changes it, with fsLock held.
+//----------------------------------------------------------------------
+
+void FileSystem::WriteOrphans()
+{
+    int list[SectorSize / sizeof(int)];
+    int n = 0;
+
+    bzero((char *)list, SectorSize);
+    for (ListIterator<Orphan *> it(orphans); !it.IsDone(); it.Next())
+    {
+        list[1 + 2 * n] = it.Item()->sector;
+        list[2 + 2 * n] = it.Item()->isDir;
+        n++;
+    }
+    list[0] = n;
+    kernel->synchDisk->WriteSector(OrphanSector, (char *)list);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::ReadOrphans
+// 	Queue the files that were removed, but not yet reclaimed, when
+//	Nachos last stopped.  Called at mount time, after the journal
+//	has been recovered.
+//----------------------------------------------------------------------
+
+void FileSystem::ReadOrphans()
+{
+    int list[SectorSize / sizeof(int)];
+    Orphan *orphan;
+    int n;
+
+    kernel->synchDisk->ReadSector(OrphanSector, (char *)list);
+    n = list[0];
+    if (n < 0 || n > MaxOrphans)
+        n = 0; // 不是這個版本 format 的 disk
+    for (int i = 0; i < n; i++)
+    {
+        orphan = new Orphan;
+        orphan->sector = list[1 + 2 * i];
+        orphan->isDir = list[2 + 2 * i];
+        orphans->Append(orphan);
+    }
+    if (n > 0)
+    {
+        DEBUG(dbgFile, n << " removed files left to reclaim");
+    }
+}
+
 //----------------------------------------------------------------------
 // FileSystem::List
-// 	List all the files in the file system directory.
+// 	List all the files in a directory, or in the whole tree below it.
 //----------------------------------------------------------------------
 
 void FileSystem::List(char *name, bool recursive)
 {
-    Directory *directory = new Directory(NumDirEntries);
-    directory->FetchFrom(directoryFile);
-    char *dirName;
-    int sector, isDir;
-    pair<int, int> temp;
-    OpenFile *openFile = directoryFile;
+    Directory *directory;
+    OpenFile *openFile;
+    char dirName[FileNameMaxLen + 1];
+    int sector, dirSector, isDir;
 
     DEBUG(alice, "list file in directory: " << name);
 
-    dirName = strtok(name, "/");
-    while(dirName != NULL) {
-        temp = directory->Find(dirName);
-        sector = temp.first;
-        isDir = temp.second;
-        ASSERT(sector != -1);
-        if (isDir) { // 這層dir存在，要繼續往下走
-            DEBUG(rain, "directory " << dirName << " exist, keepgoing!");
-            openFile = new OpenFile(sector);
-            directory->FetchFrom(openFile);
+    fsLock->Acquire();
+    sector = Lookup(name, &dirSector, &isDir, dirName);
+    if (sector == -1 || isDir != 1)
+        printf("List: %s is not a directory\n", name);
+    else if (recursive)
+        WalkTree(sector, FALSE);
+    else
+    {
+        openFile = OpenDirectory(sector);
+        directory = new Directory;
+        directory->FetchFrom(openFile);
+        directory->List();
+        delete directory;
+        CloseDirectory(openFile);
+    }
+    fsLock->Release();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::ReadDirectory
+// 	Return a copy of the entries of the directory "name" (the caller
+//	deletes it), and set "count" to how many there are.  Return NULL
+//	if "name" is not a directory.
+//----------------------------------------------------------------------
+
+DirectoryEntry *FileSystem::ReadDirectory(char *name, int *count)
+{
+    DirectoryEntry *entries = NULL;
+    char dirName[FileNameMaxLen + 1];
+    int sector, dirSector, isDir;
+
+    fsLock->Acquire();
+    sector = Lookup(name, &dirSector, &isDir, dirName);
+    if (sector != -1 && isDir == 1)
+        entries = FetchEntries(sector, count);
+    fsLock->Release();
+    return entries;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::FetchEntries
+// 	Return a copy of the entries of the directory whose header is at
+//	"sector" (the caller deletes it), and set "count" to how many
+//	there are.  The directory file is closed again.
+//----------------------------------------------------------------------
+
+DirectoryEntry *FileSystem::FetchEntries(int sector, int *count)
+{
+    Directory *directory;
+    OpenFile *openFile;
+    DirectoryEntry *entries;
+
+    openFile = OpenDirectory(sector);
+    directory = new Directory;
+    directory->FetchFrom(openFile);
+    entries = new DirectoryEntry[max(directory->NumEntries(), 1)];
+    *count = directory->GetEntries(entries);
+    delete directory;
+    CloseDirectory(openFile);
+    return entries;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::WalkTree
+// 	Visit everything below the directory whose header is at "sector",
+//	depth first and in hash order, without recursion.  With "remove",
+//	every file and directory found is freed; otherwise its name is
+//	printed, indented by its depth.
+//
+//	A stack holds a WalkFrame for each directory on the way down, so
+//	memory grows with the directories on the current path, not with
+//	the whole tree, and each directory file is closed as soon as its
+//	entries are copied.  Being removed, a directory is freed right
+//	then.  The free map only changes in memory; the caller writes
+//	the changed parts back once, at the end.
+//
+//	When a directory is entered, the headers the walk will read for
+//	its entries (all of them when removing, the subdirectories' when
+//	listing) are prefetched in order of sector number, so the disk
+//	head sweeps across them once.
+//----------------------------------------------------------------------
+
+void FileSystem::WalkTree(int sector, bool remove)
+{
+    ::List<WalkFrame *> *stack = new ::List<WalkFrame *>;
+    WalkFrame *frame;
+    DirectoryEntry *entry;
+    FileHeader *hdr;
+    int visited = 0;
+    int reads = kernel->stats->numDiskReads;
+    int writes = kernel->stats->numDiskWrites;
+
+    stack->Prepend(EnterDirectory(sector, remove));
+    while (!stack->IsEmpty())
+    {
+        frame = stack->Front();
+        if (frame->next == frame->count)
+        {
+            stack->RemoveFront();
+            delete[] frame->entries;
+            delete frame;
+            continue;
+        }
+        entry = &frame->entries[frame->next++];
+        visited++;
+        if (!remove)
+        {
+            for (int i = 1; i < (int)stack->NumInList(); i++)
+                printf("    ");
+            printf("%s %s\n", (entry->isDir == 1) ? "[D]" : "[F]",
+                   entry->name);
+        }
+        if (entry->isDir == 1)
+            stack->Prepend(EnterDirectory(entry->sector, remove));
+        if (remove)
+        { // 裡面的東西已經抄出來了，可以放掉
+            hdr = kernel->inodeTable->Get(entry->sector);
+            kernel->inodeTable->Forget(hdr);
         }
-        dirName = strtok(NULL, "/");
     }
-    if (recursive == false) {
-        directory->List();
+    delete stack;
+    DEBUG(dbgFile, (remove ? "Removed " : "Listed ") << visited
+                   << " entries, with " << kernel->stats->numDiskReads - reads
+                   << " disk reads and " << kernel->stats->numDiskWrites - writes
+                   << " disk writes");
+}
+
+//----------------------------------------------------------------------
+// FileSystem::EnterDirectory
+// 	Start a WalkFrame for the directory whose header is at "sector",
+//	and prefetch the headers WalkTree will read for its entries.
+//----------------------------------------------------------------------
+
+WalkFrame *FileSystem::EnterDirectory(int sector, bool remove)
+{
+    WalkFrame *frame = new WalkFrame;
+    int *headers;
+    int n = 0;
+
+    frame->entries = FetchEntries(sector, &frame->count);
+    frame->next = 0;
+    headers = new int[max(frame->count, 1)];
+    for (int i = 0; i < frame->count; i++)
+        if (remove || frame->entries[i].isDir == 1)
+            headers[n++] = frame->entries[i].sector;
+    kernel->synchDisk->Prefetch(headers, n);
+    delete[] headers;
+    return frame;
+}
+
+//----------------------------------------------------------------------
+// NextComponent
+// 	Copy the next component of a path into "component", skipping
+//	slashes, and advance "path" past it.  Like directory entries,
+//	components are cut to FileNameMaxLen characters.  Return FALSE
+//	at the end of the path.
+//----------------------------------------------------------------------
+
+static bool
+NextComponent(char **path, char *component)
+{
+    int length = 0;
+
+    while (**path == '/')
+        (*path)++;
+    if (**path == '\0')
+        return FALSE;
+    for (; **path != '\0' && **path != '/'; (*path)++)
+        if (length < FileNameMaxLen)
+            component[length++] = **path;
+    component[length] = '\0';
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Lookup
+// 	Follow a path from the root, one component at a time.  Each step
+//	asks the name cache first; only on a miss is the directory read,
+//	and its answer (found or not) is cached.
+//
+//	Return the header sector of the file or directory the path names,
+//	or -1 if there is none.  Also return:
+//	  "dirSector" -- header of the directory that holds (or would
+//		hold) the last component; -1 if that directory does not
+//		exist (and for the root itself)
+//	  "isDir" -- 1 if the path names a directory, 0 if a file
+//	  "leaf" -- the last component (room for FileNameMaxLen + 1)
+//
+//	"path" is not modified.
+//----------------------------------------------------------------------
+
+int FileSystem::Lookup(char *path, int *dirSector, int *isDir, char *leaf)
+{
+    int sector = DirectorySector;
+
+    *dirSector = -1;
+    *isDir = 1;
+    leaf[0] = '\0';
+    while (NextComponent(&path, leaf))
+    {
+        if (sector == -1 || *isDir != 1)
+        {
+            // 中間有一層不存在，或是 file
+            *dirSector = sector = -1;
+            continue;
+        }
+        *dirSector = sector;
+        if (!nameCache->Lookup(sector, leaf, &sector, isDir))
+        {
+            OpenFile *dirFile = OpenDirectory(*dirSector);
+            Directory *directory = new Directory;
+            pair<int, int> found;
+
+            directory->FetchFrom(dirFile);
+            found = directory->Find(leaf);
+            sector = found.first;
+            *isDir = found.second;
+            nameCache->Enter(*dirSector, leaf, sector, *isDir);
+            delete directory;
+            CloseDirectory(dirFile);
+        }
     }
-    else {
-        directory->RecursiveList(0);
+    return sector;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::OpenDirectory
+// 	Return an open file for the directory whose header is at
+//	"sector"; the root directory is always open already.
+//	CloseDirectory gives it back.
+//----------------------------------------------------------------------
+
+OpenFile *FileSystem::OpenDirectory(int sector)
+{
+    if (sector == DirectorySector)
+        return directoryFile;
+    return new OpenFile(sector);
+}
+
+void FileSystem::CloseDirectory(OpenFile *dirFile)
+{
+    if (dirFile != directoryFile)
+        delete dirFile;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Reserve
+// 	Give a file at least "numSectors" data sectors, and write back
+//	its header and the parts of the free map that changed, as one
+//	update.  Return FALSE if the disk is too full.  Used by OpenFile,
+//	when a write goes past the end of the file.
+//
+//	Writes to a directory file get here too, from operations that
+//	already hold the file system lock.
+//
+//	"hdr" -- header of the file, from the inode table
+//	"dataStart" -- new sectors before this one are left as a hole
+//----------------------------------------------------------------------
+
+bool FileSystem::Reserve(FileHeader *hdr, int numSectors, int dataStart)
+{
+    bool held = fsLock->IsHeldByCurrentThread();
+    bool success;
+
+    if (!held)
+        fsLock->Acquire();
+    kernel->synchDisk->BeginUpdate();
+    success = hdr->Reserve(freeMap, numSectors, dataStart);
+    kernel->inodeTable->SetDirty(hdr);
+    kernel->inodeTable->WriteBack(hdr);
+    freeMap->WriteBack(freeMapFile);
+    kernel->synchDisk->EndUpdate();
+    if (!held)
+        fsLock->Release();
+    return success;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Release
+// 	Free the sectors a file holds past its end, and write back its
+//	header and the free map, as one update.  Called by the inode
+//	table on the last close of the file.
+//----------------------------------------------------------------------
+
+void FileSystem::Release(FileHeader *hdr)
+{
+    bool held = fsLock->IsHeldByCurrentThread();
+
+    if (!held)
+        fsLock->Acquire();
+    kernel->synchDisk->BeginUpdate();
+    hdr->ReleaseTail(freeMap);
+    kernel->inodeTable->SetDirty(hdr);
+    kernel->inodeTable->WriteBack(hdr);
+    freeMap->WriteBack(freeMapFile);
+    kernel->synchDisk->EndUpdate();
+    if (!held)
+        fsLock->Release();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Fill
+// 	Allocate sectors for the holes among the "count" sectors of a file
+//	starting at "first", which a write is about to fill, and write
+//	back its header and the free map, as one update.  Return FALSE if
+//	the disk is too full.
+//
+//	"hdr" -- header of the file, from the inode table
+//----------------------------------------------------------------------
+
+bool FileSystem::Fill(FileHeader *hdr, int first, int count)
+{
+    bool held = fsLock->IsHeldByCurrentThread();
+    bool success;
+
+    if (!held)
+        fsLock->Acquire();
+    kernel->synchDisk->BeginUpdate();
+    success = hdr->Fill(freeMap, first, count);
+    kernel->inodeTable->SetDirty(hdr);
+    kernel->inodeTable->WriteBack(hdr);
+    freeMap->WriteBack(freeMapFile);
+    kernel->synchDisk->EndUpdate();
+    if (!held)
+        fsLock->Release();
+    return success;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Free
+// 	Free the data sectors and the header sector of a removed file.
+//	Called by the inode table, when the last user of the header is
+//	done with it: right away from Remove, the reclaimer or a tree
+//	walk, which hold the lock and write back the free map at the
+//	end; otherwise on the last close of a file removed while open,
+//	which makes it an update of its own.
+//----------------------------------------------------------------------
+
+void FileSystem::Free(FileHeader *hdr, int sector)
+{
+    bool held = fsLock->IsHeldByCurrentThread();
+
+    if (!held)
+    {
+        fsLock->Acquire();
+        kernel->synchDisk->BeginUpdate();
     }
-    
-    delete directory;
+    hdr->Deallocate(freeMap); // remove data blocks
+    freeMap->Clear(sector);   // remove header block
+    kernel->synchDisk->Revoke(sector);
+    if (!held)
+    {
+        freeMap->WriteBack(freeMapFile);
+        kernel->synchDisk->EndUpdate();
+        fsLock->Release();
+    }
+    DEBUG(dbgFile, "Freed the file with its header at " << sector);
 }
 
 //----------------------------------------------------------------------
 // FileSystem::Print
 // 	Print everything about the file system:
-//	  the contents of the bitmap
+//	  the contents of the bitmap, and how many sectors are free
 //	  the contents of the directory
 //	  for each file in the directory,
 //	      the contents of the file header
@@ -478,28 +1004,29 @@ void FileSystem::List(char *name, bool recursive)
 
 void FileSystem::Print()
 {
-    FileHeader *bitHdr = new FileHeader;
-    FileHeader *dirHdr = new FileHeader;
-    PersistentBitmap *freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-    Directory *directory = new Directory(NumDirEntries);
+    FileHeader *bitHdr, *dirHdr;
+    Directory *directory = new Directory;
+
+    fsLock->Acquire();
+    bitHdr = kernel->inodeTable->Get(FreeMapSector);
+    dirHdr = kernel->inodeTable->Get(DirectorySector);
 
     printf("Bit map file header:\n");
-    bitHdr->FetchFrom(FreeMapSector);
     bitHdr->Print();
 
     printf("Directory file header:\n");
-    dirHdr->FetchFrom(DirectorySector);
     dirHdr->Print();
 
     freeMap->Print();
+    printf("Free sectors: %d\n", freeMap->NumClear());
 
     directory->FetchFrom(directoryFile);
     directory->Print();
 
-    delete bitHdr;
-    delete dirHdr;
-    delete freeMap;
+    kernel->inodeTable->Put(bitHdr);
+    kernel->inodeTable->Put(dirHdr);
     delete directory;
+    fsLock->Release();
 }
 
 #endif // FILESYS_STUB
@@ -37,6 +37,16 @@
 #include "sysdep.h"
 #include "openfile.h"
 #include "string.h"
+#include "list.h"
+
+class PersistentBitmap;
+class DentryCache;
+class FileHeader;
+class DirectoryEntry;
+class WalkFrame;
+class Orphan;
+class Lock;
+class Semaphore;
 
 typedef int OpenFileId;
 
@@ -97,18 +107,59 @@ public:
 	OpenFile *Open(char *name); // Open a file (UNIX open)
 
 	bool Remove(char *name, bool recursive); // Delete a file (UNIX unlink)
+	void StartReclaimer();	// From now on, Remove leaves freeing the
+							// space to a thread of its own
+	void Reclaim();			// Free the space of everything removed
+							// so far
 
 	void List(char *name, bool recursive); // List all the files in the directory
 
+	DirectoryEntry *ReadDirectory(char *name, int *count);
+										// The entries of a directory,
+										// NULL if it is not one
+
 	void Print(); // List all the files and their contents
 
-	OpenFile *curFile; // 現在打開的file，因為題目說一次只會有一個file被open，所以用一個變數存就好了
+	bool Reserve(FileHeader *hdr, int numSectors,
+				 int dataStart = 0);	// Allocate data sectors
+										// for a growing file
+	void Release(FileHeader *hdr);		// Free those it did not use
+	bool Fill(FileHeader *hdr, int first, int count);
+										// Allocate sectors for the
+										// holes a write falls in
+	void Free(FileHeader *hdr, int sector);
+										// Free a removed file, once
+										// nobody has it open
 
 private:
+	friend void ReclaimerThread(void *arg); // waits for orphans
+
 	OpenFile *freeMapFile;	 // Bit map of free disk blocks,
 							 // represented as a file
+	PersistentBitmap *freeMap; // The bit map itself, kept in memory
+							   // while Nachos is running
 	OpenFile *directoryFile; // "Root" directory -- list of
 							 // file names, represented as a file
+	DentryCache *nameCache;	 // Recent path component lookups
+
+	Lock *fsLock;			   // Held by every operation on the free
+							   // map and the directories
+	::List<Orphan *> *orphans; // Removed, and not freed yet
+	Semaphore *reclaimWanted;  // The reclaimer waits here; NULL
+							   // if Remove frees space itself
+
+	int Lookup(char *path, int *dirSector, int *isDir, char *leaf);
+	// Find the header sector of "path"
+	OpenFile *OpenDirectory(int sector); // Open a directory file
+	void CloseDirectory(OpenFile *dirFile); // ... and close it
+	DirectoryEntry *FetchEntries(int sector, int *count);
+										// Copy of a directory's entries
+	void WalkTree(int sector, bool remove); // List or remove everything
+											// below a directory
+	WalkFrame *EnterDirectory(int sector, bool remove);
+										// Start on one directory of it
+	void WriteOrphans();				// Keep the reclaimer's queue
+	void ReadOrphans();					// on disk
 };
 
 #endif // FILESYS
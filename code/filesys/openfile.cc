@@ -5,7 +5,8 @@
 //	the OpenFile data structure).
 //
 //	Also as in UNIX, for convenience, we keep the file header in
-//	memory while the file is open.
+//	memory while the file is open.  It comes from the kernel's inode
+//	table, so every OpenFile of the same file shares it.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -18,29 +19,56 @@
 #include "openfile.h"
 #include "synchdisk.h"
 
+// A file that grows holds some sectors past its end, so that the next
+// writes need not allocate.  How many doubles each time, up to a cap.
+#define GrowMinSectors 4
+#define GrowMaxSectors 128
+
+// OpenFiles whose write buffer holds something, so that it can all be
+// written out when Nachos halts, or when another OpenFile for the same
+// file needs it
+static List<OpenFile *> *bufferedFiles = NULL;
+
 //----------------------------------------------------------------------
 // OpenFile::OpenFile
 // 	Open a Nachos file for reading and writing.  Bring the file header
-//	into memory while the file is open.
+//	into memory while the file is open (unless another OpenFile for
+//	the same file already has).  Writes the others have buffered are
+//	written out, so this one sees them.
 //
 //	"sector" -- the location on disk of the file header for this file
 //----------------------------------------------------------------------
 
 OpenFile::OpenFile(int sector)
 {
-    hdr = new FileHeader;
-    hdr->FetchFrom(sector);
+    hdr = kernel->inodeTable->Get(sector);
+    hdrSector = sector;
     seekPosition = 0;
+    readEnd = 0;
+    aheadWindow = 0;
+    aheadEnd = 0;
+    growChunk = 0;
+    writeBuf = new char[SectorSize];
+    bufSector = -1;
+    writeLost = FALSE;
+    FlushOthers();
 }
 
 //----------------------------------------------------------------------
 // OpenFile::~OpenFile
 // 	Close a Nachos file, de-allocating any in-memory data structures.
+//	The write buffer is written out (the Close system call flushes it
+//	first, to report a full disk).  The header goes back to the inode
+//	table; if this was the last OpenFile using it, the sectors the
+//	file holds past its end are given back, and the header is written
+//	to disk if it changed.
 //----------------------------------------------------------------------
 
 OpenFile::~OpenFile()
 {
-    delete hdr;
+    Flush();
+    delete[] writeBuf;
+    kernel->inodeTable->Put(hdr);
 }
 
 //----------------------------------------------------------------------
@@ -48,11 +76,14 @@ OpenFile::~OpenFile()
 // 	Change the current location within the open file -- the point at
 //	which the next Read or Write will start from.
 //
+//	What the write buffer holds is written out first.
+//
 //	"position" -- the location within the file for the next Read/Write
 //----------------------------------------------------------------------
 
 void OpenFile::Seek(int position)
 {
+    Flush();
     seekPosition = position;
 }
 
@@ -93,12 +124,29 @@ int OpenFile::Write(char *into, int numBytes)
 //	boundary; however the disk only knows how to read/write a whole disk
 //	sector at a time.  Thus:
 //
+//	The data of a small file may be in its header instead; it is then
+//	just copied, and moved out to a sector when the file outgrows it.
+//
 //	For ReadAt:
 //	   We read in all of the full or partial sectors that are part of the
-//	   request, but we only copy the part we are interested in.
+//	   request, but we only copy the part we are interested in.  Sectors
+//	   in a hole are not read; they are all zeros.
 //	For WriteAt:
+//	   A write of less than a sector, to a single sector, is only
+//	   copied into the write buffer; so are the writes after it to
+//	   the bytes around it.  The buffer is written out (see below)
+//	   when a write goes elsewhere, or the file is read there, sought
+//	   in, or closed.  Since the header is shared, reads and writes
+//	   through any other OpenFile for the file write it out first,
+//	   as does opening the file again.  Writes made during an update
+//	   to the metadata (to a directory or the free map, say) are not
+//	   buffered, since they must be logged along with the update.
+//	   Other writes are done by WriteThrough:
+//	   A write past the end of the file first makes the file longer,
+//	   and holes the write falls in get sectors.
 //	   We must first read in any sectors that will be partially written,
-//	   so that we don't overwrite the unmodified portion.  We then copy
+//	   so that we don't overwrite the unmodified portion (unless they
+//	   have just been allocated, and hold nothing yet).  We then copy
 //	   in the data that will be modified, and write back all the full
 //	   or partial sectors that are part of the request.
 //
@@ -111,25 +159,83 @@ int OpenFile::Write(char *into, int numBytes)
 
 int OpenFile::ReadAt(char *into, int numBytes, int position)
 {
-    int fileLength = hdr->FileLength();
-    int i, firstSector, lastSector, numSectors;
+    int fileLength;
+    int i, firstSector, lastSector, numSectors, sector, run;
+    int ahead, aheadDone, aheadSector, extra;
     char *buf;
 
+    FlushOthers();
+    if (bufSector != -1 && numBytes > 0 &&
+        ((position < bufEnd && position + numBytes > bufStart) ||
+         position + numBytes > hdr->FileLength()))
+        Flush(); // the read wants what is buffered, or may
+    fileLength = hdr->FileLength();
     if ((numBytes <= 0) || (position >= fileLength))
         return 0; // check request
     if ((position + numBytes) > fileLength)
         numBytes = fileLength - position;
     DEBUG(dbgFile, "Reading " << numBytes << " bytes at " << position << " from file of length " << fileLength);
+    if (hdr->IsInline())
+    { // 資料在 header 裡，不用讀 disk
+        hdr->ReadInline(into, numBytes, position);
+        return numBytes;
+    }
 
     firstSector = divRoundDown(position, SectorSize);
     lastSector = divRoundDown(position + numBytes - 1, SectorSize);
     numSectors = 1 + lastSector - firstSector;
 
-    // read in all the full and partial sectors that we need
+    // Read-ahead.  While the file is read sequentially, each time the
+    // reader reaches the end of what was prefetched, prefetch the next
+    // window of sectors, doubling the window every time.  A read that
+    // does not continue where the last one stopped collapses it.
+    ahead = 0;
+    if (position != readEnd)
+    {
+        aheadWindow = 0;
+        aheadEnd = 0;
+    }
+    else if (lastSector + 1 >= aheadEnd)
+    {
+        if (aheadWindow == 0)
+            aheadWindow = kernel->readAheadMin;
+        else
+            aheadWindow = min(aheadWindow * 2, kernel->readAheadMax);
+        ahead = min(aheadWindow, divRoundUp(fileLength, SectorSize) - lastSector - 1);
+        aheadEnd = lastSector + 1 + ahead;
+    }
+    readEnd = position + numBytes;
+
+    // read in all the full and partial sectors that we need,
+    // one request per run of physically contiguous sectors
     buf = new char[numSectors * SectorSize];
-    for (i = firstSector; i <= lastSector; i++)
-        kernel->synchDisk->ReadSector(hdr->ByteToSector(i * SectorSize),
-                                      &buf[(i - firstSector) * SectorSize]);
+    aheadDone = 0;
+    for (i = firstSector; i <= lastSector; i += run)
+    {
+        run = ContiguousSectors(i, lastSector, &sector);
+        if (sector == -1)
+        { // 洞，不用讀
+            memset(&buf[(i - firstSector) * SectorSize], 0, run * SectorSize);
+            continue;
+        }
+        extra = 0;
+        if ((i + run > lastSector) && (ahead > 0))
+        { // the prefetch can ride along if it continues on disk
+            extra = ContiguousSectors(lastSector + 1, lastSector + ahead, &aheadSector);
+            if (aheadSector != sector + run)
+                extra = 0;
+        }
+        kernel->synchDisk->ReadSectors(sector, run,
+                                       &buf[(i - firstSector) * SectorSize], extra);
+        aheadDone = extra;
+    }
+    // and whatever is left of the window, elsewhere on disk
+    for (i = lastSector + 1 + aheadDone; i <= lastSector + ahead; i += run)
+    {
+        run = ContiguousSectors(i, lastSector + ahead, &sector);
+        if (sector != -1)
+            kernel->synchDisk->ReadSectors(sector, 0, NULL, run);
+    }
 
     // copy the part we want
     bcopy(&buf[position - (firstSector * SectorSize)], into, numBytes);
@@ -140,20 +246,170 @@ int OpenFile::ReadAt(char *into, int numBytes, int position)
 
 int OpenFile::WriteAt(char *from, int numBytes, int position)
 {
-    int fileLength = hdr->FileLength();
-    int i, firstSector, lastSector, numSectors;
-    bool firstAligned, lastAligned;
+    int sector = divRoundDown(position, SectorSize);
+
+    if (numBytes <= 0)
+        return 0;
+    FlushOthers(); // so the writes land in the order they were made
+    if (numBytes < SectorSize && !hdr->IsInline() &&
+        kernel->currentThread->updateDepth == 0 &&
+        divRoundDown(position + numBytes - 1, SectorSize) == sector)
+    { // 小的 write，先放在 buffer 裡
+        if (bufSector != -1 &&
+            (sector != bufSector || position > bufEnd || position + numBytes < bufStart))
+            Flush(); // not next to what is buffered
+        if (bufSector == -1)
+        {
+            bufSector = sector;
+            bufStart = position;
+            bufEnd = position + numBytes;
+            if (bufferedFiles == NULL)
+                bufferedFiles = new List<OpenFile *>;
+            bufferedFiles->Append(this);
+        }
+        bcopy(from, &writeBuf[position - sector * SectorSize], numBytes);
+        bufStart = min(bufStart, position);
+        bufEnd = max(bufEnd, position + numBytes);
+        return numBytes;
+    }
+    Flush();
+    return WriteThrough(from, numBytes, position);
+}
+
+//----------------------------------------------------------------------
+// OpenFile::Flush
+// 	Write what the write buffer holds to the file, with one
+//	WriteThrough: the sector is read and written once, however many
+//	small writes went into it.  If the disk turns out to be full, the
+//	buffered bytes that do not fit are lost.
+//
+//	Return FALSE if that happened, here or in an earlier Flush whose
+//	caller (Seek, a write elsewhere, another OpenFile) did not report
+//	it, so that Close and Fsync can.
+//----------------------------------------------------------------------
+
+bool OpenFile::Flush()
+{
+    bool lost = writeLost;
+
+    writeLost = FALSE;
+    if (bufSector == -1)
+        return !lost;
+    bufferedFiles->Remove(this);
+    int start = bufStart - bufSector * SectorSize;
+    int length = bufEnd - bufStart;
+    bufSector = -1;
+    if (WriteThrough(&writeBuf[start], length, bufStart) < length)
+        lost = TRUE;
+    return !lost;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::FlushOthers
+// 	Write out the write buffers of the other OpenFiles for this file,
+//	which share its header.  A write lost there is left for their
+//	own Flush to report.
+//----------------------------------------------------------------------
+
+void OpenFile::FlushOthers()
+{
+    OpenFile *other;
+
+    do
+    { // Flush 會等 disk，list 可能變了，每次從頭找
+        other = NULL;
+        if (bufferedFiles == NULL)
+            return;
+        for (ListIterator<OpenFile *> it(bufferedFiles); !it.IsDone(); it.Next())
+            if (it.Item() != this && it.Item()->hdr == hdr)
+            {
+                other = it.Item();
+                break;
+            }
+        if (other != NULL && !other->Flush())
+            other->writeLost = TRUE;
+    } while (other != NULL);
+}
+
+//----------------------------------------------------------------------
+// OpenFile::FlushAll
+// 	Write out the write buffers of all OpenFiles; called when Nachos
+//	halts, since open files are not closed then.
+//----------------------------------------------------------------------
+
+void OpenFile::FlushAll()
+{
+    while (bufferedFiles != NULL && !bufferedFiles->IsEmpty())
+        bufferedFiles->Front()->Flush();
+}
+
+//----------------------------------------------------------------------
+// OpenFile::WriteThrough
+// 	The work of WriteAt, for a write that does not go into the
+//	write buffer.
+//----------------------------------------------------------------------
+
+int OpenFile::WriteThrough(char *from, int numBytes, int position)
+{
+    int fileLength, mapped;
+    int i, firstSector, lastSector, numSectors, sector, run;
+    bool firstAligned, lastAligned, firstNew, lastNew;
     char *buf;
 
-    if ((numBytes <= 0) || (position >= fileLength))
+    if (numBytes <= 0)
         return 0; // check request
-    if ((position + numBytes) > fileLength)
-        numBytes = fileLength - position;
-    DEBUG(dbgFile, "Writing " << numBytes << " bytes at " << position << " from file of length " << fileLength);
+    if (hdr->IsInline())
+    {
+        if (position + numBytes <= MaxInlineBytes)
+        { // 還放得進 header
+            hdr->WriteInline(from, numBytes, position);
+            kernel->inodeTable->SetDirty(hdr);
+            return numBytes;
+        }
+        MoveInline();
+    }
+    fileLength = hdr->FileLength();
+    mapped = hdr->MappedSectors(); // sectors from here on are new
+    if (position > fileLength && fileLength < mapped * SectorSize)
+    {
+        // 跳過的部分裡已經有 sector 的（最後一個 sector 剩下的、預留的），
+        // 先寫成 0；再過去的部分由 Grow 變成洞
+        int zeroEnd = min(position, mapped * SectorSize);
+        char *zeros = new char[zeroEnd - fileLength];
+
+        memset(zeros, 0, zeroEnd - fileLength);
+        WriteThrough(zeros, zeroEnd - fileLength, fileLength);
+        delete[] zeros;
+        if (hdr->FileLength() < zeroEnd)
+            return 0; // the disk is full
+        fileLength = zeroEnd;
+    }
 
     firstSector = divRoundDown(position, SectorSize);
     lastSector = divRoundDown(position + numBytes - 1, SectorSize);
+
+    // sectors in a hole, or past those the file has, hold nothing yet
+    firstNew = (firstSector >= mapped) ||
+               (hdr->ByteToSector(firstSector * SectorSize) == -1);
+    lastNew = (lastSector >= mapped) ||
+              (hdr->ByteToSector(lastSector * SectorSize) == -1);
+
+    if ((position + numBytes) > fileLength && Grow(position, position + numBytes))
+        fileLength = hdr->FileLength();
+    if (position >= fileLength)
+        return 0; // the disk is full
+    if ((position + numBytes) > fileLength)
+    {
+        numBytes = fileLength - position;
+        lastSector = divRoundDown(position + numBytes - 1, SectorSize);
+        lastNew = TRUE; // what follows is past the end
+    }
     numSectors = 1 + lastSector - firstSector;
+    DEBUG(dbgFile, "Writing " << numBytes << " bytes at " << position << " from file of length " << fileLength);
+
+    if (hdr->HasHole(firstSector, lastSector) &&
+        !kernel->fileSystem->Fill(hdr, firstSector, numSectors))
+        return 0; // the disk is full
 
     buf = new char[numSectors * SectorSize];
 
@@ -163,23 +419,144 @@ int OpenFile::WriteAt(char *from, int numBytes, int position)
     lastAligned = ((position + numBytes) == ((lastSector + 1) * SectorSize));
 
     // read in first and last sector, if they are to be partially modified
-    if (!firstAligned)
-        ReadAt(buf, SectorSize, firstSector * SectorSize);
-    if (!lastAligned && ((firstSector != lastSector) || firstAligned))
-        ReadAt(&buf[(lastSector - firstSector) * SectorSize],
-               SectorSize, lastSector * SectorSize);
+    // (straight from the disk, so as not to disturb the read-ahead)
+    if (!firstAligned && !firstNew)
+        kernel->synchDisk->ReadSector(hdr->ByteToSector(firstSector * SectorSize), buf);
+    if (!lastAligned && !lastNew && ((firstSector != lastSector) || firstAligned))
+        kernel->synchDisk->ReadSector(hdr->ByteToSector(lastSector * SectorSize),
+                                      &buf[(lastSector - firstSector) * SectorSize]);
 
     // copy in the bytes we want to change
     bcopy(from, &buf[position - (firstSector * SectorSize)], numBytes);
 
     // write modified sectors back
-    for (i = firstSector; i <= lastSector; i++)
-        kernel->synchDisk->WriteSector(hdr->ByteToSector(i * SectorSize),
-                                       &buf[(i - firstSector) * SectorSize]);
+    for (i = firstSector; i <= lastSector; i += run)
+    {
+        run = ContiguousSectors(i, lastSector, &sector);
+        kernel->synchDisk->WriteSectors(sector, run,
+                                        &buf[(i - firstSector) * SectorSize]);
+    }
     delete[] buf;
     return numBytes;
 }
 
+//----------------------------------------------------------------------
+// OpenFile::Grow
+// 	Make the file "newLength" bytes long, for a write at "position"
+//	past its end.  When it needs more sectors, it takes a chunk more
+//	than that, so that a file written a little at a time does not
+//	allocate (and rewrite the free map) on every write.  The chunk
+//	doubles each time, up to GrowMaxSectors; the part not used is
+//	given back when the file is last closed.  Return FALSE if the
+//	disk is full.
+//
+//	Sectors skipped between the sectors the file has and "position"
+//	become a hole.  If the write starts in a hole at the end of the
+//	file, that is given sectors first, so the new ones follow it.
+//----------------------------------------------------------------------
+
+bool OpenFile::Grow(int position, int newLength)
+{
+    int mapped = hdr->MappedSectors();
+    int wanted = divRoundUp(newLength, SectorSize);
+    int dataStart = divRoundDown(position, SectorSize);
+
+    if (wanted > mapped)
+    {
+        if (dataStart < mapped && hdr->HasHole(dataStart, mapped - 1) &&
+            !kernel->fileSystem->Fill(hdr, dataStart, mapped - dataStart))
+            return FALSE;
+        growChunk = (growChunk == 0) ? GrowMinSectors : min(2 * growChunk, GrowMaxSectors);
+        if (!kernel->fileSystem->Reserve(hdr, wanted + growChunk, dataStart) &&
+            !kernel->fileSystem->Reserve(hdr, wanted, dataStart))
+            return FALSE;
+    }
+    hdr->SetLength(newLength);
+    kernel->inodeTable->SetDirty(hdr);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::MoveInline
+// 	The file's data is in its header, and a write is about to make it
+//	too long for that.  Give the data a sector of its own.
+//----------------------------------------------------------------------
+
+void OpenFile::MoveInline()
+{
+    char data[MaxInlineBytes];
+    int length = hdr->FileLength();
+
+    hdr->MoveInline(data);
+    kernel->inodeTable->SetDirty(hdr);
+    if (length > 0)
+        WriteThrough(data, length, 0);
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ContiguousSectors
+// 	Starting at file sector "from", count how many of the file sectors
+//	up to "to" sit next to each other on disk, so they can move in
+//	one disk request; or, if "from" is in a hole, how many of them
+//	are in the hole.
+//
+//	"from", "to" -- file sector numbers (not disk sectors)
+//	"sector" -- is set to the disk sector holding file sector "from",
+//		-1 for a hole
+//----------------------------------------------------------------------
+
+int OpenFile::ContiguousSectors(int from, int to, int *sector)
+{
+    int run = 1;
+    int step = 1;
+
+    *sector = hdr->ByteToSector(from * SectorSize);
+    if (*sector == -1)
+        step = 0; // 洞連著洞
+    while ((from + run <= to) && (run < MaxRequestSectors) &&
+           (hdr->ByteToSector((from + run) * SectorSize) == *sector + run * step))
+        run++;
+    return run;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::Extend
+// 	Grow the file to "newLength" bytes.  The changed header is stored
+//	back to disk when the file is last closed.  Return FALSE if the
+//	disk is too full; the file is then left unchanged.
+//
+//	"freeMap" -- the bit map of free disk sectors; the caller writes
+//		it back
+//	"newLength" -- the new length of the file
+//----------------------------------------------------------------------
+
+bool OpenFile::Extend(PersistentBitmap *freeMap, int newLength)
+{
+    if (!hdr->Extend(freeMap, newLength))
+        return FALSE;
+    kernel->inodeTable->SetDirty(hdr);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::Preallocate
+// 	Give the holes in the first "numBytes" bytes of the file their
+//	disk sectors now, all at once, so that they can go in one run
+//	instead of one run per write that fills them.  For a writer that
+//	knows how long the file will be.  Return FALSE if the disk is too
+//	full; nothing is allocated then, and the writes fill the holes
+//	as usual.
+//----------------------------------------------------------------------
+
+bool OpenFile::Preallocate(int numBytes)
+{
+    int numSectors = divRoundUp(min(numBytes, hdr->FileLength()), SectorSize);
+
+    if (hdr->IsInline() || numSectors == 0 || !hdr->HasHole(0, numSectors - 1))
+        return TRUE;
+    return kernel->fileSystem->Fill(hdr, 0, numSectors);
+}
+
 //----------------------------------------------------------------------
 // OpenFile::Length
 // 	Return the number of bytes in the file.
@@ -187,6 +564,9 @@ int OpenFile::WriteAt(char *from, int numBytes, int position)
 
 int OpenFile::Length()
 {
+    FlushOthers();
+    if (bufSector != -1)
+        return max(hdr->FileLength(), bufEnd); // counting what is buffered
     return hdr->FileLength();
 }
 
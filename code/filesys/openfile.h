@@ -74,6 +74,7 @@ private:
 
 #else // FILESYS
 class FileHeader;
+class PersistentBitmap;
 
 class OpenFile
 {
@@ -101,9 +102,50 @@ public:
 				  // than the UNIX idiom -- lseek to
 				  // end of file, tell, lseek back
 
+	bool Extend(PersistentBitmap *freeMap, int newLength);
+	// Make the file "newLength" bytes long
+	bool Preallocate(int numBytes); // Give the holes in the first
+									// "numBytes" sectors up front
+
+	bool Flush();			// Write out what the write buffer holds;
+							// FALSE if some buffered write (now or
+							// earlier) did not fit on the disk
+	static void FlushAll(); // ... for every OpenFile (at halt,
+							// and on Sync)
+
 private:
-	FileHeader *hdr;  // Header for this file
+	FileHeader *hdr;  // Header for this file, shared with
+					  // other OpenFiles for it
+	int hdrSector;	  // Where the header lives on disk
 	int seekPosition; // Current position within the file
+
+	int readEnd;	 // Where the last ReadAt stopped
+	int aheadWindow; // Sectors to prefetch next time
+	int aheadEnd;	 // First file sector not yet prefetched
+
+	int growChunk; // Sectors to hold past the end
+				   // the next time the file grows
+
+	char *writeBuf; // Small writes to one sector, not yet
+					// written; laid out as the sector is
+	int bufSector;	// Which file sector, -1 if none
+	int bufStart;	// The bytes written, as file offsets:
+	int bufEnd;		// [bufStart, bufEnd)
+	bool writeLost; // A buffered write did not fit; not
+					// reported by Flush yet
+
+	int WriteThrough(char *from, int numBytes, int position);
+											// WriteAt, without the buffer
+	void FlushOthers();						// Write out the buffers of the
+											// other OpenFiles for the file
+	bool Grow(int position, int newLength); // Make the file longer, for
+											// a WriteAt at "position"
+	void MoveInline();						// Move data out of the
+											// header, for WriteAt
+	int ContiguousSectors(int from, int to, int *sector); // Length of the
+														  // run of file sectors
+														  // adjacent on disk,
+														  // or of a hole
 };
 
 #endif // FILESYS
@@ -21,6 +21,12 @@
 
 PersistentBitmap::PersistentBitmap(int numItems) : Bitmap(numItems)
 {
+    numGroups = divRoundUp(numItems, SectorsPerGroup);
+    groupFree = new int[numGroups];
+    CountGroups();
+    numMapSectors = divRoundUp(numWords * sizeof(unsigned), SectorSize);
+    dirty = new bool[numMapSectors];
+    SetDirty(TRUE); // nothing on disk yet
 }
 
 //----------------------------------------------------------------------
@@ -41,6 +47,13 @@ PersistentBitmap::PersistentBitmap(OpenFile *file, int numItems) : Bitmap(numIte
     // but we will just overwrite that with the contents of the
     // map found in the file
     file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    Recount();
+    numGroups = divRoundUp(numItems, SectorsPerGroup);
+    groupFree = new int[numGroups];
+    CountGroups();
+    numMapSectors = divRoundUp(numWords * sizeof(unsigned), SectorSize);
+    dirty = new bool[numMapSectors];
+    SetDirty(FALSE);
 }
 
 //----------------------------------------------------------------------
@@ -50,6 +63,8 @@ PersistentBitmap::PersistentBitmap(OpenFile *file, int numItems) : Bitmap(numIte
 
 PersistentBitmap::~PersistentBitmap()
 {
+    delete[] groupFree;
+    delete[] dirty;
 }
 
 //----------------------------------------------------------------------
@@ -62,16 +77,163 @@ PersistentBitmap::~PersistentBitmap()
 void PersistentBitmap::FetchFrom(OpenFile *file)
 {
     file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    Recount();
+    CountGroups();
+    SetDirty(FALSE);
 }
 
 //----------------------------------------------------------------------
 // PersistentBitmap::WriteBack
 // 	Store the contents of a persistent bitmap to a Nachos file.
+//	Only the sectors of the file that hold changed bits are written,
+//	each run of them with one WriteAt.
 //
 //	"file" is the place to write the bitmap to
 //----------------------------------------------------------------------
 
 void PersistentBitmap::WriteBack(OpenFile *file)
 {
-    file->WriteAt((char *)map, numWords * sizeof(unsigned), 0);
+    int mapBytes = numWords * sizeof(unsigned);
+    int first, last, start;
+
+    for (first = 0; first < numMapSectors; first = last)
+    {
+        if (!dirty[first])
+        {
+            last = first + 1;
+            continue;
+        }
+        for (last = first; last < numMapSectors && dirty[last]; last++)
+            dirty[last] = FALSE;
+        start = first * SectorSize;
+        file->WriteAt((char *)map + start,
+                      min(last * SectorSize, mapBytes) - start, start);
+    }
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::OnZeroedDisk
+// 	The file holding the bitmap reads as all zeros (the disk has just
+//	been erased), so the next WriteBack need only write the sectors
+//	of the file with a bit set.
+//----------------------------------------------------------------------
+
+void PersistentBitmap::OnZeroedDisk()
+{
+    int wordsPerSector = SectorSize / sizeof(unsigned);
+
+    for (int i = 0; i < numMapSectors; i++)
+    {
+        dirty[i] = FALSE;
+        for (int w = i * wordsPerSector; w < min(numWords, (i + 1) * wordsPerSector); w++)
+            if (map[w] != 0)
+                dirty[i] = TRUE;
+    }
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::SetDirty
+// 	Mark every sector of the bitmap file as changed, or unchanged.
+//----------------------------------------------------------------------
+
+void PersistentBitmap::SetDirty(bool value)
+{
+    for (int i = 0; i < numMapSectors; i++)
+        dirty[i] = value;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::CountGroups
+// 	Count the clear bits in every track group.
+//----------------------------------------------------------------------
+
+void PersistentBitmap::CountGroups()
+{
+    for (int g = 0; g < numGroups; g++)
+        groupFree[g] = NumClear(g * SectorsPerGroup, SectorsPerGroup);
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::BitChanged
+// 	A bit was set or cleared; adjust the count of its group, and
+//	remember that its sector of the bitmap file needs writing.
+//----------------------------------------------------------------------
+
+void PersistentBitmap::BitChanged(int which, bool set)
+{
+    groupFree[which / SectorsPerGroup] += set ? -1 : 1;
+    dirty[(which / BitsInWord) * sizeof(unsigned) / SectorSize] = TRUE;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::StartAt
+// 	Make the next search (FindAndSet, FindAndSetRange...) begin at
+//	the start of "group".
+//----------------------------------------------------------------------
+
+void PersistentBitmap::StartAt(int group)
+{
+    hint = group * SectorsPerGroup / BitsInWord;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::PlaceNear
+// 	Have the next allocations made in the track group holding
+//	"sector" -- for a file, that of its directory -- or, if that
+//	group is full, in the next group that is not.
+//----------------------------------------------------------------------
+
+void PersistentBitmap::PlaceNear(int sector)
+{
+    int group = sector / SectorsPerGroup;
+
+    for (int i = 0; i < numGroups; i++)
+    {
+        if (groupFree[(group + i) % numGroups] > 0)
+        {
+            StartAt((group + i) % numGroups);
+            return;
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::PlaceDirectory
+// 	Have the next allocations made in a group suitable for a new
+//	directory: the first group after the parent's with at least the
+//	average amount of free space.  Spreading directories out leaves
+//	room in each group for the files that will go in it.
+//----------------------------------------------------------------------
+
+void PersistentBitmap::PlaceDirectory(int parentSector)
+{
+    int group = parentSector / SectorsPerGroup;
+    int average = NumClear() / numGroups;
+
+    for (int i = 1; i <= numGroups; i++)
+    {
+        int g = (group + i) % numGroups;
+        if (groupFree[g] > 0 && groupFree[g] >= average)
+        {
+            StartAt(g);
+            return;
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::PlaceLarge
+// 	Have the next allocations made in the group with the most free
+//	space, for the data of a file too big to fit in its directory's
+//	group without crowding out the directory's other files.
+//----------------------------------------------------------------------
+
+void PersistentBitmap::PlaceLarge()
+{
+    int best = 0;
+
+    for (int g = 1; g < numGroups; g++)
+        if (groupFree[g] > groupFree[best])
+            best = g;
+    StartAt(best);
 }
@@ -16,10 +16,24 @@
 #include "copyright.h"
 #include "bitmap.h"
 #include "openfile.h"
+#include "disk.h"
+
+// The disk is divided into track groups of TracksPerGroup consecutive
+// tracks (like the cylinder groups of the BSD fast file system).  A
+// seek within a group is short, so the file system tries to keep a
+// file's header and data in the same group as its directory.
+const int TracksPerGroup = 32;
+const int SectorsPerGroup = TracksPerGroup * SectorsPerTrack;
 
 // The following class defines a persistent bitmap.  It inherits all
 // the behavior of a bitmap (see bitmap.h), adding the ability to
 // be read from and stored to the disk.
+//
+// It also keeps, for each track group, the number of clear bits in
+// the group, and can point the next allocation at a chosen group.
+//
+// The bitmap remembers which sectors of its file hold bits that changed
+// since it was read or written, and WriteBack writes only those.
 
 class PersistentBitmap : public Bitmap
 {
@@ -30,7 +44,33 @@ public:
     ~PersistentBitmap(); // deallocate bitmap
 
     void FetchFrom(OpenFile *file); // read bitmap from the disk
-    void WriteBack(OpenFile *file); // write bitmap contents to disk
+    void WriteBack(OpenFile *file); // write changed parts of the bitmap
+                                    // to disk
+    void OnZeroedDisk();            // the file reads as all zeros; only
+                                    // the sectors with set bits change
+
+    void PlaceNear(int sector);            // Make the next allocations
+                                           // start in the group of "sector"
+    void PlaceDirectory(int parentSector); // ... in a roomy group other
+                                           // than the parent's
+    void PlaceLarge();                     // ... in the emptiest group
+
+    int GroupFree(int group) { return groupFree[group]; }
+                                           // Clear bits in a group
+
+protected:
+    void BitChanged(int which, bool set); // Keep groupFree up to date
+
+private:
+    int numGroups;  // Number of track groups
+    int *groupFree; // Clear bits in each group
+
+    int numMapSectors; // Sectors in the bitmap file
+    bool *dirty;       // dirty[i]: file sector i has changed
+
+    void CountGroups();       // Recompute groupFree from the bitmap
+    void SetDirty(bool value); // Mark every sector dirty (or clean)
+    void StartAt(int group);  // Point the next-fit hint at a group
 };
 
 #endif // PBITMAP_H
@@ -5,10 +5,38 @@
 //	the disk providing a synchronous interface (requests wait until
 //	the request completes).
 //
-//	Use a semaphore to synchronize the interrupt handlers with the
-//	pending requests.  And, because the physical disk can only
-//	handle one operation at a time, use a lock to enforce mutual
-//	exclusion.
+//	Each request waits on its own semaphore, which the interrupt
+//	handler signals.  Because the physical disk can only handle one
+//	operation at a time, requests that arrive while it is busy are
+//	queued, and the interrupt handler starts the next one as soon
+//	as the current one is done.  Which one goes next is decided by
+//	the scheduling policy: arrival order, C-SCAN, or shortest
+//	positioning time first.
+//
+//	Recently used sectors are kept in a buffer cache.  The cache is
+//	write-back: WriteSector only updates the buffer and marks it
+//	dirty, and the sector is written to disk when the buffer is
+//	chosen for replacement, or on Flush (which Interrupt::Halt calls
+//	before Nachos exits).  Replacement uses the CLOCK algorithm.
+//	The cache lock is let go while a thread waits for the disk, so
+//	that other threads can use the cache (and queue their own
+//	requests) meanwhile; buffers being read or written are marked
+//	busy until the I/O is done.
+//
+//	Once the file system starts a journal, the sectors written by an
+//	update to its metadata are also logged.  They stay pinned in the
+//	cache until their group is committed to the log, and reach their
+//	home sectors later, like any other dirty buffer.  Without a cache
+//	the journal keeps its own copies, which reads are served from,
+//	and writes them home as soon as their group is committed.
+//	A sector freed while the log holds an image of it is revoked, so
+//	that the image is not replayed over whatever it holds next.
+//
+//	A flusher thread writes dirty buffers back before their buffers
+//	are wanted: those that have been dirty for FlushTicks, and more
+//	whenever too much of the cache is dirty.  It sleeps on a
+//	semaphore, and is woken by writers and by the timer; it keeps
+//	no interrupt of its own pending, so Nachos can still halt.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -16,32 +44,96 @@
 
 #include "copyright.h"
 #include "synchdisk.h"
+#include "main.h"
+
+static const char *policyName[] = {"FIFO", "C-SCAN", "SPTF"};
+
+// Records in the log.  The first sector of the log region holds a
+// LogStart record; each group is LogDescriptor records, each followed
+// by the sector images it lists, then any LogRevoke records (listing
+// sectors whose images in earlier groups must not be replayed), and
+// then a LogCommit record.
+#define LogStart 0x4a524e4c
+#define LogDescriptor 0x4a444553
+#define LogRevoke 0x4a52564b
+#define LogCommit 0x4a434d54
+#define SectorsPerRecord ((int)((SectorSize - 3 * sizeof(int)) / sizeof(int)))
+
+class LogRecord
+{
+public:
+    int magic;    // Which kind of record
+    int sequence; // Group it belongs to
+    int count;    // Sector images that follow
+    int sectors[SectorsPerRecord]; // Where each of them belongs
+};
 
 //----------------------------------------------------------------------
 // SynchDisk::SynchDisk
 // 	Initialize the synchronous interface to the physical disk, in turn
 //	initializing the physical disk.
 //
+//	"cacheSize" is the number of sectors the buffer cache can hold;
+//	0 means every request goes straight to the disk.
+//	"policy" is the order in which queued requests are served.
 //----------------------------------------------------------------------
 
-SynchDisk::SynchDisk()
+SynchDisk::SynchDisk(int cacheSize, DiskSchedPolicy policy)
 {
-    semaphore = new Semaphore("synch disk", 0);
     lock = new Lock("synch disk lock");
+    blockReady = new Condition("synch disk buffer");
     disk = new Disk(this);
+
+    this->policy = policy;
+    queue = new List<DiskRequest *>;
+    active = NULL;
+    formatting = FALSE;
+    journal = NULL;
+    kernel->stats->diskPolicyName = policyName[policy];
+
+    numBlocks = cacheSize;
+    blocks = NULL;
+    hashTable = NULL;
+    clockHand = 0;
+    numDirty = 0;
+    oldestDirty = 0;
+    flushWanted = NULL;
+    flusherIdle = FALSE;
+    if (numBlocks > 0)
+    {
+        blocks = new CacheBlock[numBlocks];
+        hashTable = new CacheBlock *[numBlocks];
+        for (int i = 0; i < numBlocks; i++)
+        {
+            blocks[i].sector = -1;
+            blocks[i].dirty = FALSE;
+            blocks[i].referenced = FALSE;
+            blocks[i].busy = FALSE;
+            blocks[i].prefetched = FALSE;
+            blocks[i].pinned = FALSE;
+            blocks[i].dirtySince = 0;
+            blocks[i].hashNext = NULL;
+            hashTable[i] = NULL;
+        }
+    }
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::~SynchDisk
 // 	De-allocate data structures needed for the synchronous disk
-//	abstraction.
+//	abstraction.  Dirty buffers must already have been flushed.
 //----------------------------------------------------------------------
 
 SynchDisk::~SynchDisk()
 {
+    delete journal;
     delete disk;
+    delete blockReady;
     delete lock;
-    delete semaphore;
+    delete queue;
+    delete flushWanted;
+    delete[] blocks;
+    delete[] hashTable;
 }
 
 //----------------------------------------------------------------------
@@ -55,16 +147,13 @@ SynchDisk::~SynchDisk()
 
 void SynchDisk::ReadSector(int sectorNumber, char *data)
 {
-    lock->Acquire(); // only one disk I/O at a time
-    disk->ReadRequest(sectorNumber, data);
-    semaphore->P(); // wait for interrupt
-    lock->Release();
+    ReadSectors(sectorNumber, 1, data);
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::WriteSector
-// 	Write the contents of a buffer into a disk sector.  Return only
-//	after the data has been written.
+// 	Write the contents of a buffer into a disk sector.  The new
+//	contents go into the cache, and reach the disk later.
 //
 //	"sectorNumber" -- the disk sector to be written
 //	"data" -- the new contents of the disk sector
@@ -72,19 +161,1585 @@ void SynchDisk::ReadSector(int sectorNumber, char *data)
 
 void SynchDisk::WriteSector(int sectorNumber, char *data)
 {
-    lock->Acquire(); // only one disk I/O at a time
-    disk->WriteRequest(sectorNumber, data);
-    semaphore->P(); // wait for interrupt
+    WriteSectors(sectorNumber, 1, data);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadSectors
+// 	Read "numSectors" consecutive disk sectors into "data".  Cached
+//	sectors are copied out of the cache; each run of sectors that are
+//	not cached is brought in with a single disk request, straight
+//	into the buffers that will hold them.
+//
+//	The "readAhead" sectors after those are brought into the cache
+//	too (those not already there), as part of the same requests when
+//	they are adjacent to a run being read anyway.  They are marked
+//	prefetched, so we can tell later whether reading them paid off.
+//	Without a cache there is nowhere to put them, so they are skipped.
+//
+//	"sectorNumber" -- the first disk sector to read
+//	"numSectors" -- how many sectors to read
+//	"data" -- the buffer to hold the sectors, back to back
+//	"readAhead" -- how many more sectors to prefetch
+//----------------------------------------------------------------------
+
+void SynchDisk::ReadSectors(int sectorNumber, int numSectors, char *data,
+                            int readAhead)
+{
+    char *list[MaxRequestSectors];
+    CacheBlock *run[MaxRequestSectors];
+    CacheBlock *block;
+    int i, n, maxRun, total;
+
+    if (numBlocks == 0)
+    {
+        ReadUncached(sectorNumber, numSectors, data);
+        return;
+    }
+
+    // a run must not be so long that it evicts its own buffers, and
+    // prefetching a good part of the cache would push out what was
+    // prefetched before it is used
+    maxRun = min(MaxRequestSectors, max(1, numBlocks / 2));
+    readAhead = min(readAhead, numBlocks / 4);
+    total = min(numSectors + readAhead, NumSectors - sectorNumber);
+    lock->Acquire();
+    for (i = 0; i < total; i += n)
+    {
+        n = 0;
+        if ((block = Lookup(sectorNumber + i)) != NULL)
+        {
+            if (block->busy)
+            { // someone else is moving it; look again when done
+                blockReady->Wait(lock);
+                continue;
+            }
+            n = 1;
+            if (i >= numSectors)
+                continue; // already here, nothing to prefetch
+            kernel->stats->numCacheHits++;
+            if (block->prefetched)
+            {
+                kernel->stats->numReadAheadHits++;
+                block->prefetched = FALSE;
+            }
+            block->referenced = TRUE;
+            bcopy(block->data, &data[i * SectorSize], SectorSize);
+            continue;
+        }
+
+        // gather the run of sectors that are not cached
+        for (; (i + n < total) && (n < maxRun); n++)
+        {
+            if (n > 0 && Lookup(sectorNumber + i + n) != NULL)
+                break;
+            if ((block = GetBlock(sectorNumber + i + n, n == 0)) == NULL)
+                break; // the lock was let go; read what we have
+            block->busy = TRUE;
+            block->prefetched = (i + n >= numSectors);
+            run[n] = block;
+            list[n] = block->data;
+        }
+        if (n == 0)
+            continue; // try this sector again
+        if (i + n > numSectors)
+        {
+            kernel->stats->numReadAheadSectors += i + n - max(i, numSectors);
+            kernel->stats->numCacheMisses += max(numSectors - i, 0);
+        }
+        else
+            kernel->stats->numCacheMisses += n;
+
+        lock->Release();
+        DoRequest(sectorNumber + i, n, list, FALSE);
+        lock->Acquire();
+
+        for (int j = 0; j < n; j++)
+        {
+            if (i + j < numSectors)
+                bcopy(list[j], &data[(i + j) * SectorSize], SectorSize);
+            run[j]->busy = FALSE;
+        }
+        blockReady->Broadcast(lock);
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteSectors
+// 	Write "numSectors" consecutive disk sectors from "data".  The new
+//	contents go into the cache, and reach the disk later.
+//
+//	"sectorNumber" -- the first disk sector to be written
+//	"numSectors" -- how many sectors to write
+//	"data" -- the new contents of the sectors, back to back
+//----------------------------------------------------------------------
+
+void SynchDisk::WriteSectors(int sectorNumber, int numSectors, char *data)
+{
+    CacheBlock *block;
+    bool counted;
+    int i;
+
+    if (numBlocks == 0)
+    {
+        WriteUncached(sectorNumber, numSectors, data);
+        return;
+    }
+
+    lock->Acquire();
+    for (i = 0; i < numSectors;)
+    {
+        // the whole sector is overwritten, so a miss need not read it
+        if ((block = Lookup(sectorNumber + i)) != NULL)
+        {
+            if (block->busy)
+            {
+                blockReady->Wait(lock);
+                continue;
+            }
+            kernel->stats->numCacheHits++;
+        }
+        else
+        {
+            if ((block = GetBlock(sectorNumber + i, TRUE)) == NULL)
+                continue; // the lock was let go; look again
+            kernel->stats->numCacheMisses++;
+        }
+        counted = block->dirty && !block->pinned;
+        if (!block->dirty)
+            block->dirtySince = kernel->stats->totalTicks;
+        block->referenced = TRUE;
+        block->dirty = TRUE;
+        block->prefetched = FALSE;
+        bcopy(&data[i * SectorSize], block->data, SectorSize);
+        if (journal != NULL && journal->Note(sectorNumber + i, block->data))
+            block->pinned = TRUE;
+        if (counted && block->pinned)
+            numDirty--; // 被 journal 接手了
+        else if (!counted && !block->pinned)
+            CountDirty(block);
+        i++;
+    }
+    lock->Release();
+    WakeFlusher();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Prefetch
+// 	Bring "numSectors" sectors, which are about to be read one at a
+//	time in some other order, into the cache in order of sector
+//	number, each run of consecutive ones with one request.  The
+//	array is sorted in the process.  Without a cache there is
+//	nowhere to keep them; and at most half the cache is used, so
+//	that the first of them are still there when they are read.
+//----------------------------------------------------------------------
+
+static int CompareSectors(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+void SynchDisk::Prefetch(int *sectors, int numSectors)
+{
+    char *buf;
+    int n;
+
+    if (numBlocks == 0 || numSectors == 0)
+        return;
+    qsort(sectors, numSectors, sizeof(int), CompareSectors);
+    numSectors = min(numSectors, numBlocks / 2);
+    buf = new char[MaxRequestSectors * SectorSize];
+    for (int i = 0; i < numSectors; i += n)
+    {
+        for (n = 1; i + n < numSectors && n < MaxRequestSectors &&
+                    sectors[i + n] == sectors[i] + n;
+             n++)
+            ;
+        ReadSectors(sectors[i], n, buf);
+    }
+    delete[] buf;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Flush
+// 	Write every dirty buffer back to disk.  The buffers stay cached.
+//	With a journal, the group being gathered is committed first
+//	(once other threads are out of their updates).
+//	Then wait for the disk to have it all in its UNIX file.
+//----------------------------------------------------------------------
+
+void SynchDisk::Flush()
+{
+    if (journal != NULL)
+        journal->Sync();
+    else
+        WriteBackAll();
+    disk->Sync();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteBackAll
+// 	Write every dirty buffer back to disk, except those pinned by
+//	the journal.
+//----------------------------------------------------------------------
+
+void SynchDisk::WriteBackAll()
+{
+    int i = 0;
+
+    lock->Acquire();
+    while (i < numBlocks)
+    {
+        if (blocks[i].busy)
+            blockReady->Wait(lock); // it may come back dirty
+        else if (blocks[i].sector >= 0 && blocks[i].dirty && !blocks[i].pinned)
+            WriteBackRun(&blocks[i]);
+        else
+            i++;
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Unpin
+// 	The group that logged "sectorNumber" is committed; the buffer
+//	may go to disk now, unless the group gathered since logged it
+//	again.  A thread waiting in GetBlock because every buffer was
+//	busy or pinned may find one now.
+//----------------------------------------------------------------------
+
+void SynchDisk::Unpin(int sectorNumber)
+{
+    CacheBlock *block;
+
+    lock->Acquire();
+    if ((block = Lookup(sectorNumber)) != NULL && block->pinned &&
+        !journal->Logged(sectorNumber))
+    {
+        block->pinned = FALSE;
+        if (block->dirty)
+            CountDirty(block);
+        blockReady->Broadcast(lock);
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::CountDirty
+// 	"block" has become dirty and unpinned, so the flusher may write
+//	it back.  Called with the lock held.
+//----------------------------------------------------------------------
+
+void SynchDisk::CountDirty(CacheBlock *block)
+{
+    if (numDirty++ == 0 || block->dirtySince < oldestDirty)
+        oldestDirty = block->dirtySince;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::StartFlusher
+// 	Fork the thread that writes dirty buffers back in the background.
+//	Without a cache there is nothing for it to do.
+//----------------------------------------------------------------------
+
+void FlusherThread(void *arg)
+{
+    SynchDisk *synchDisk = (SynchDisk *)arg;
+
+    for (;;)
+    {
+        synchDisk->flusherIdle = TRUE;
+        synchDisk->flushWanted->P();
+        synchDisk->WriteBackOld();
+    }
+}
+
+void SynchDisk::StartFlusher()
+{
+    Thread *t;
+
+    if (numBlocks == 0)
+        return;
+    flushWanted = new Semaphore("flusher", 0);
+    t = new Thread("flusher", -1);
+    t->Fork((VoidFunctionPtr)FlusherThread, (void *)this);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WakeFlusher
+// 	Let the flusher run, if it is waiting and either some buffer has
+//	been dirty for FlushTicks or more than DirtyPercent of the cache
+//	is dirty.  Called after every write, and on every timer
+//	interrupt (with interrupts off), so it must be quick and must
+//	not wait.
+//----------------------------------------------------------------------
+
+void SynchDisk::WakeFlusher()
+{
+    if (flushWanted == NULL || !flusherIdle || numDirty == 0)
+        return;
+    if (numDirty * 100 > numBlocks * DirtyPercent ||
+        kernel->stats->totalTicks - oldestDirty >= FlushTicks)
+    {
+        flusherIdle = FALSE;
+        flushWanted->V();
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteBackOld
+// 	One round of the flusher: write back every buffer that has been
+//	dirty for FlushTicks, and, while more than half of DirtyPercent
+//	of the cache is dirty, any other dirty buffer too.  Pinned and
+//	busy buffers are left alone.  The buffers are taken in the order
+//	the clock hand will reach them, so those about to be reused are
+//	clean by then, and the writes go out in the order they would
+//	have anyway.
+//
+//	The flusher only uses the disk when nobody else is: as soon as
+//	another request is waiting it stops, and tries again when next
+//	woken.  Then work out again when the oldest dirty buffer became
+//	dirty.
+//----------------------------------------------------------------------
+
+void SynchDisk::WriteBackOld()
+{
+    CacheBlock *block;
+    int now = kernel->stats->totalTicks;
+    int start;
+
+    lock->Acquire();
+    start = clockHand;
+    for (int i = 0; i < numBlocks; i++)
+    {
+        block = &blocks[(start + i) % numBlocks];
+        if (active != NULL || !queue->IsEmpty())
+            break; // 不跟別人搶 disk
+        if (block->sector < 0 || !block->dirty || block->busy || block->pinned)
+            continue;
+        if (numDirty * 200 > numBlocks * DirtyPercent ||
+            now - block->dirtySince >= FlushTicks)
+            WriteBackRun(block);
+    }
+
+    oldestDirty = kernel->stats->totalTicks;
+    for (int i = 0; i < numBlocks; i++)
+    {
+        block = &blocks[i];
+        if (block->sector >= 0 && block->dirty && !block->pinned &&
+            block->dirtySince < oldestDirty)
+            oldestDirty = block->dirtySince;
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::StartFormat/EndFormat
+// 	Bracket the laying down of a new file system.  StartFormat sets
+//	the whole disk to zeros, so only the sectors that must hold
+//	something else need be written.  Until EndFormat, requests are
+//	done on the spot, taking no simulated time: formatting is not
+//	part of the work being measured.  EndFormat writes everything
+//	cached back the same way.
+//----------------------------------------------------------------------
+
+void SynchDisk::StartFormat()
+{
+    lock->Acquire();
+    for (int i = 0; i < numBlocks; i++)
+        if (blocks[i].sector >= 0)
+        { // 舊 disk 的內容，不能再用
+            ASSERT(!blocks[i].busy && !blocks[i].pinned);
+            Unhash(&blocks[i]);
+            blocks[i].sector = -1;
+            blocks[i].dirty = FALSE;
+        }
+    numDirty = 0;
+    lock->Release();
+    disk->Erase();
+    formatting = TRUE;
+}
+
+void SynchDisk::EndFormat()
+{
+    Flush();
+    formatting = FALSE;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::StartJournal
+// 	Log the metadata updates of the file system in the "numSectors"
+//	sectors starting at "firstSector".  A new disk gets an empty
+//	log; otherwise what the log holds is replayed first, in case
+//	Nachos stopped without writing it home.
+//----------------------------------------------------------------------
+
+void SynchDisk::StartJournal(int firstSector, int numSectors, bool format)
+{
+    journal = new Journal(this, firstSector, numSectors);
+    if (format)
+        journal->Format();
+    else
+        journal->Recover();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::BeginUpdate/EndUpdate
+// 	Bracket an update to the file system metadata, so that it is
+//	logged as a whole.  Updates may nest.
+//----------------------------------------------------------------------
+
+void SynchDisk::BeginUpdate()
+{
+    if (journal != NULL)
+        journal->Begin();
+}
+
+void SynchDisk::EndUpdate()
+{
+    if (journal != NULL)
+        journal->End();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Revoke
+// 	"sectorNumber" has been given back to the free map; see
+//	Journal::Revoke.  If that took it out of the group being
+//	gathered, and no group being committed holds it either, its
+//	buffer need not stay pinned.
+//----------------------------------------------------------------------
+
+void SynchDisk::Revoke(int sectorNumber)
+{
+    CacheBlock *block;
+
+    if (journal == NULL)
+        return;
+    lock->Acquire();
+    journal->Revoke(sectorNumber);
+    if (numBlocks > 0 && (block = Lookup(sectorNumber)) != NULL &&
+        block->pinned && !journal->Logged(sectorNumber) &&
+        !journal->Committing(sectorNumber))
+    {
+        block->pinned = FALSE;
+        if (block->dirty)
+            CountDirty(block);
+        blockReady->Broadcast(lock);
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteBackRun
+// 	Write a dirty buffer back to disk.  Dirty buffers holding the
+//	sectors just before and after it go along in the same request,
+//	since the disk head passes over them anyway.
+//
+//	The lock is let go while the write is in progress; the buffers
+//	are busy meanwhile.
+//----------------------------------------------------------------------
+
+void SynchDisk::WriteBackRun(CacheBlock *block)
+{
+    char *list[MaxRequestSectors];
+    CacheBlock *run[MaxRequestSectors];
+    CacheBlock *b;
+    int first = block->sector;
+    int n;
+
+    ASSERT(block->dirty && !block->busy && !block->pinned);
+    while ((first > 0) && (block->sector - first + 1 < MaxRequestSectors) &&
+           ((b = Lookup(first - 1)) != NULL) && b->dirty && !b->busy &&
+           !b->pinned)
+        first--;
+    for (n = 0; (n < MaxRequestSectors) && (first + n < NumSectors) &&
+                ((b = Lookup(first + n)) != NULL) && b->dirty && !b->busy &&
+                !b->pinned;
+         n++)
+    {
+        b->busy = TRUE;
+        run[n] = b;
+        list[n] = b->data;
+    }
+
+    lock->Release();
+    DoRequest(first, n, list, TRUE);
+    lock->Acquire();
+
+    for (int i = 0; i < n; i++)
+    {
+        run[i]->dirty = FALSE;
+        run[i]->busy = FALSE;
+    }
+    numDirty -= n;
+    kernel->stats->numCacheWriteBacks += n;
+    blockReady->Broadcast(lock);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Lookup
+// 	Return the buffer holding "sectorNumber", or NULL if the sector
+//	is not cached.
+//----------------------------------------------------------------------
+
+CacheBlock *SynchDisk::Lookup(int sectorNumber)
+{
+    CacheBlock *block = hashTable[sectorNumber % numBlocks];
+
+    while (block != NULL && block->sector != sectorNumber)
+        block = block->hashNext;
+    return block;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Unhash
+// 	Remove a buffer from its hash bucket.
+//----------------------------------------------------------------------
+
+void SynchDisk::Unhash(CacheBlock *block)
+{
+    CacheBlock **prev = &hashTable[block->sector % numBlocks];
+
+    while (*prev != block)
+        prev = &(*prev)->hashNext;
+    *prev = block->hashNext;
+    block->hashNext = NULL;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::GetBlock
+// 	Choose a buffer to hold "sectorNumber", which is not in the cache.
+//	Sweep the clock hand over the buffers, giving each recently used
+//	buffer a second chance, and take the first one that was not used
+//	since the last sweep.  Busy and pinned buffers are skipped.
+//
+//	The buffer is returned hashed under its new sector, with
+//	its old contents; the caller fills in the data.
+//
+//	Returns NULL if the lock had to be let go: either the chosen
+//	buffer was dirty and has been written back, or every buffer was
+//	busy or pinned and (if "canWait") we waited for one.  The caller must then
+//	look the sector up again, since another thread may have cached
+//	it meanwhile.  A caller that holds busy buffers of its own must
+//	not wait, or it could wait for itself.
+//----------------------------------------------------------------------
+
+CacheBlock *SynchDisk::GetBlock(int sectorNumber, bool canWait)
+{
+    CacheBlock *block;
+    int looked = 0;
+
+    for (;;)
+    {
+        if (looked++ > 2 * numBlocks)
+        { // everything is busy
+            if (canWait)
+                blockReady->Wait(lock);
+            return NULL;
+        }
+        block = &blocks[clockHand];
+        clockHand = (clockHand + 1) % numBlocks;
+        if (block->busy || block->pinned)
+            continue;
+        if (block->sector < 0 || !block->referenced)
+            break;
+        block->referenced = FALSE;
+    }
+
+    if (block->sector >= 0)
+    {
+        if (block->dirty)
+        {
+            WriteBackRun(block);
+            return NULL;
+        }
+        if (block->prefetched)
+            kernel->stats->numReadAheadWasted++; // never used
+        Unhash(block);
+    }
+    block->sector = sectorNumber;
+    block->prefetched = FALSE;
+    block->dirty = FALSE;
+    block->referenced = TRUE;
+    block->hashNext = hashTable[sectorNumber % numBlocks];
+    hashTable[sectorNumber % numBlocks] = block;
+    return block;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Transfer
+// 	Read or write "numSectors" consecutive sectors straight from or to
+//	the disk, in requests of at most MaxRequestSectors.
+//----------------------------------------------------------------------
+
+void SynchDisk::Transfer(int sectorNumber, int numSectors, char *data,
+                         bool writing)
+{
+    char *list[MaxRequestSectors];
+    int i, n;
+
+    for (i = 0; i < numSectors; i += n)
+    {
+        n = min(numSectors - i, MaxRequestSectors);
+        for (int j = 0; j < n; j++)
+            list[j] = &data[(i + j) * SectorSize];
+        DoRequest(sectorNumber + i, n, list, writing);
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadUncached
+// 	Read "numSectors" consecutive sectors when there is no cache.
+//	A sector the journal holds an image of that is not home yet is
+//	copied from there; each run of the others takes one request.
+//----------------------------------------------------------------------
+
+void SynchDisk::ReadUncached(int sectorNumber, int numSectors, char *data)
+{
+    int i, n;
+
+    if (journal == NULL)
+    {
+        Transfer(sectorNumber, numSectors, data, FALSE);
+        return;
+    }
+    for (i = 0; i < numSectors; i += max(n, 1))
+    {
+        lock->Acquire();
+        for (n = 0; i + n < numSectors &&
+                    !journal->Read(sectorNumber + i + n, &data[(i + n) * SectorSize]);
+             n++)
+            ;
+        lock->Release();
+        if (n > 0)
+            Transfer(sectorNumber + i, n, &data[i * SectorSize], FALSE);
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteUncached
+// 	Write "numSectors" consecutive sectors when there is no cache.
+//	Those the journal logs stay with it until their group is
+//	committed; each run of the others goes to disk in one request.
+//	A sector in the group being committed must wait until that
+//	group's image of it is home, or the image would land on top.
+//----------------------------------------------------------------------
+
+void SynchDisk::WriteUncached(int sectorNumber, int numSectors, char *data)
+{
+    int i, n;
+
+    if (journal == NULL)
+    {
+        Transfer(sectorNumber, numSectors, data, TRUE);
+        return;
+    }
+    lock->Acquire();
+    for (i = 0; i < numSectors;)
+    {
+        if (journal->Note(sectorNumber + i, &data[i * SectorSize]))
+        {
+            i++;
+            continue;
+        }
+        if (journal->Committing(sectorNumber + i))
+        {
+            blockReady->Wait(lock);
+            continue;
+        }
+        // 不在 update 裡的話，後面不在 group 裡的 sector 都不會 log
+        for (n = 1; i + n < numSectors && n < MaxRequestSectors &&
+                    kernel->currentThread->updateDepth == 0 &&
+                    !journal->Logged(sectorNumber + i + n) &&
+                    !journal->Committing(sectorNumber + i + n);
+             n++)
+            ;
+        lock->Release();
+        Transfer(sectorNumber + i, n, &data[i * SectorSize], TRUE);
+        lock->Acquire();
+        i += n;
+    }
     lock->Release();
 }
 
+//----------------------------------------------------------------------
+// SynchDisk::DoRequest
+// 	Queue a (possibly multi-sector) request for the disk, and wait
+//	until the disk has finished it.  If the disk is idle, the request
+//	is started right away.  The caller must not hold the cache lock.
+//	While formatting, it is done at once instead.
+//----------------------------------------------------------------------
+
+void SynchDisk::DoRequest(int sectorNumber, int numSectors, char **data,
+                          bool writing)
+{
+    DiskRequest request;
+    Semaphore done("disk request", 0);
+    IntStatus oldLevel;
+
+    if (formatting)
+    { // 不算時間
+        disk->Copy(sectorNumber, numSectors, data, writing);
+        return;
+    }
+    request.sector = sectorNumber;
+    request.numSectors = numSectors;
+    request.data = data;
+    request.writing = writing;
+    request.arrival = kernel->stats->totalTicks;
+    request.done = &done;
+
+    // the queue is shared with the interrupt handler
+    oldLevel = kernel->interrupt->SetLevel(IntOff);
+    queue->Append(&request);
+    if (active == NULL)
+        Dispatch();
+    (void)kernel->interrupt->SetLevel(oldLevel);
+
+    done.P(); // wait for interrupt
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::NextRequest
+// 	Take the request that should be served next off the queue.
+//
+//	FIFO   -- the oldest one.
+//	C-SCAN -- the lowest sector at or past the head; if there is none,
+//	          the head goes back to the lowest sector waiting.
+//	SPTF   -- the one the disk can reach soonest, as computed by
+//	          Disk::ComputeLatency.  Ties go to the oldest.
+//----------------------------------------------------------------------
+
+DiskRequest *SynchDisk::NextRequest()
+{
+    ListIterator<DiskRequest *> iter(queue);
+    DiskRequest *best = NULL, *lowest = NULL;
+    int head = disk->HeadSector();
+    int bestTime = 0;
+
+    if (policy == DiskFIFO)
+        return queue->RemoveFront();
+
+    for (; !iter.IsDone(); iter.Next())
+    {
+        DiskRequest *r = iter.Item();
+        if (policy == DiskCSCAN)
+        {
+            if (lowest == NULL || r->sector < lowest->sector)
+                lowest = r;
+            if (r->sector >= head && (best == NULL || r->sector < best->sector))
+                best = r;
+        }
+        else
+        {
+            int time = disk->ComputeLatency(r->sector, r->writing);
+            if (best == NULL || time < bestTime)
+            {
+                best = r;
+                bestTime = time;
+            }
+        }
+    }
+    if (best == NULL)
+        best = lowest; // C-SCAN wraps around
+    queue->Remove(best);
+    return best;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Dispatch
+// 	The disk is idle and requests are waiting: start the next one.
+//	Called with interrupts off.
+//----------------------------------------------------------------------
+
+void SynchDisk::Dispatch()
+{
+    active = NextRequest();
+    if (active->writing)
+        disk->WriteRequest(active->sector, active->numSectors, active->data);
+    else
+        disk->ReadRequest(active->sector, active->numSectors, active->data);
+}
+
 //----------------------------------------------------------------------
 // SynchDisk::CallBack
-// 	Disk interrupt handler.  Wake up any thread waiting for the disk
-//	request to finish.
+// 	Disk interrupt handler.  Wake up the thread waiting for the disk
+//	request to finish, and start the next request, if any.
 //----------------------------------------------------------------------
 
 void SynchDisk::CallBack()
 {
-    semaphore->V();
+    kernel->stats->diskLatencyTicks += kernel->stats->totalTicks - active->arrival;
+    active->done->V();
+    active = NULL;
+    if (!queue->IsEmpty())
+        Dispatch();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::SelfTest
+// 	Have several threads read sectors scattered over the disk at the
+//	same time, so that requests pile up in the queue, and print how
+//	far the head moved and how long requests waited.  Only reads, so
+//	the disk contents are not disturbed.  Run it with -ds to compare
+//	the scheduling policies.
+//----------------------------------------------------------------------
+
+const int TestThreads = 6;
+const int TestReads = 40;
+const int TestTracks = 2000; // keep the total time within an int
+
+static Semaphore *testDone;
+
+static void
+ReadScattered(void *arg)
+{
+    int which = (int)(long)arg;
+    char buf[SectorSize];
+
+    for (int i = 0; i < TestReads; i++)
+    {
+        // spread over the tracks, each thread in its own pattern
+        int track = (which * 347 + i * (which + 3) * 151) % TestTracks;
+        int sector = track * SectorsPerTrack + (which * 7 + i * 13) % SectorsPerTrack;
+        kernel->synchDisk->ReadSector(sector, buf);
+    }
+    testDone->V();
+}
+
+void SynchDisk::SelfTest()
+{
+    int startTracks = kernel->stats->numDiskSeekTracks;
+    int startTicks = kernel->stats->diskLatencyTicks;
+    int startRequests = kernel->stats->numDiskReads;
+    int requests;
+
+    testDone = new Semaphore("disk test done", 0);
+    for (int i = 0; i < TestThreads; i++)
+    {
+        Thread *t = new Thread("disk tester", i + 1);
+        t->Fork((VoidFunctionPtr)ReadScattered, (void *)(long)i);
+    }
+    for (int i = 0; i < TestThreads; i++)
+        testDone->P();
+    delete testDone;
+
+    requests = kernel->stats->numDiskReads - startRequests;
+    cout << "Disk scheduling test (" << policyName[policy] << "): "
+         << requests << " requests, seek tracks "
+         << kernel->stats->numDiskSeekTracks - startTracks
+         << ", average latency "
+         << (kernel->stats->diskLatencyTicks - startTicks) / max(requests, 1)
+         << " ticks\n";
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::JournalTest
+// 	Test that the journal replays a committed group after a crash;
+//	see Journal::SelfTest.  The file system must have started one.
+//----------------------------------------------------------------------
+
+void SynchDisk::JournalTest()
+{
+    ASSERT(journal != NULL);
+    journal->SelfTest();
+}
+
+//----------------------------------------------------------------------
+// Journal::Journal
+// 	Set up an (as yet unread) log in the "numSectors" sectors starting
+//	at "firstSector".  Format or Recover is called next.
+//
+//	Logged sectors stay in the cache until their group is committed,
+//	so the cache must be at least MinCacheSize; without one, the
+//	group's own copies of them are all there is.
+//----------------------------------------------------------------------
+
+Journal::Journal(SynchDisk *disk, int firstSector, int numSectors)
+{
+    this->disk = disk;
+    this->firstSector = firstSector;
+    this->numSectors = numSectors;
+    head = firstSector + 1;
+    sequence = 1;
+    depth = 0;
+    groupStart = 0;
+    count = 0;
+    maxCount = MaxGroupSectors;
+    ASSERT(disk->numBlocks == 0 || disk->numBlocks >= MinCacheSize);
+    homes = new int[MaxGroupSectors];
+    images = new char[MaxGroupSectors * SectorSize];
+    revokeCount = 0;
+    revokes = new int[MaxGroupSectors];
+    revokesLost = FALSE;
+    commitCount = 0;
+    commitHomes = new int[MaxGroupSectors];
+    commitImages = new char[MaxGroupSectors * SectorSize];
+    commitRevokes = new int[MaxGroupSectors];
+    inLog = new Bitmap(NumSectors);
+    commitLock = new Lock("journal");
+    updatesDone = new Condition("journal updates");
+    syncWaiting = 0;
+}
+
+Journal::~Journal()
+{
+    delete[] homes;
+    delete[] images;
+    delete[] revokes;
+    delete[] commitHomes;
+    delete[] commitImages;
+    delete[] commitRevokes;
+    delete inLog;
+    delete commitLock;
+    delete updatesDone;
+}
+
+//----------------------------------------------------------------------
+// Journal::Format
+// 	Start an empty log.  Records left over from an earlier file system
+//	on this disk must not pass for new ones, so the sequence numbers
+//	go on from past anything that log can hold.
+//----------------------------------------------------------------------
+
+void Journal::Format()
+{
+    LogRecord record;
+
+    disk->Transfer(firstSector, 1, (char *)&record, FALSE);
+    if (record.magic == LogStart)
+        sequence = record.sequence + numSectors;
+    head = firstSector + 1;
+    WriteRecord(LogStart, sequence);
+}
+
+//----------------------------------------------------------------------
+// Journal::Recover
+// 	Copy every group in the log whose commit record made it to disk
+//	to its home sectors, in order, and then empty the log.  A group
+//	that was cut off is ignored: none of its updates happened.
+//
+//	A sector image is skipped if the sector was revoked by the same
+//	or a later committed group: the sector was freed, and may have
+//	been written since without being logged.  So the log is read
+//	twice, first only its records, to find those groups and what
+//	they revoked.
+//----------------------------------------------------------------------
+
+void Journal::Recover()
+{
+    LogRecord record;
+    int *revokedIn;
+    int start, committed;
+
+    disk->Transfer(firstSector, 1, (char *)&record, FALSE);
+    if (record.magic != LogStart)
+    { // 舊的 disk，沒有 log
+        Format();
+        return;
+    }
+    start = record.sequence;
+    revokedIn = new int[NumSectors];
+    bzero((char *)revokedIn, NumSectors * sizeof(int));
+    committed = ScanLog(start, start + numSectors, revokedIn, FALSE);
+    sequence = committed;
+    if (head < firstSector + numSectors)
+    {
+        disk->Transfer(head, 1, (char *)&record, FALSE);
+        if (record.sequence == sequence)
+            sequence++; // a group was cut off; its records must not count
+    }
+    ScanLog(start, committed, revokedIn, TRUE);
+    delete[] revokedIn;
+
+    count = 0;
+    revokeCount = 0;
+    revokesLost = FALSE;
+    delete inLog;
+    inLog = new Bitmap(NumSectors);
+    head = firstSector + 1;
+    if (sequence != start)
+        WriteRecord(LogStart, sequence);
+}
+
+//----------------------------------------------------------------------
+// Journal::ScanLog
+// 	Walk the log from the top, group "seq" first, up to the first
+//	group that has no commit record, or group "stop"; return the
+//	number of that group.  "head" is left where it would start.
+//
+//	Without "replay", only the records are read, and "revokedIn"
+//	gets, for each sector a committed group revoked, the number of
+//	the last such group.  With it, the sector images are written
+//	home, except those "revokedIn" says were revoked later on.
+//----------------------------------------------------------------------
+
+int Journal::ScanLog(int seq, int stop, int *revokedIn, bool replay)
+{
+    LogRecord record;
+    int end = firstSector + numSectors;
+    int pending = 0; // revoked by this group, if it commits
+    int replayed = 0;
+
+    head = firstSector + 1;
+    while (head < end && seq < stop)
+    {
+        disk->Transfer(head, 1, (char *)&record, FALSE);
+        if (record.sequence != seq)
+            break;
+        if (record.magic == LogCommit)
+        {
+            for (int i = 0; i < pending; i++)
+                revokedIn[homes[i]] = seq;
+            if (replay)
+            {
+                DEBUG(dbgFile, "Replayed group " << seq << ", " << replayed << " sectors");
+            }
+            pending = replayed = 0;
+            seq++;
+            head++;
+            continue;
+        }
+        if (record.count < 0 || record.count > SectorsPerRecord)
+            break;
+        if (record.magic == LogRevoke)
+        {
+            if (pending + record.count > MaxGroupSectors)
+                break;
+            if (!replay)
+            {
+                bcopy(record.sectors, &homes[pending], record.count * sizeof(int));
+                pending += record.count;
+            }
+            head++;
+            continue;
+        }
+        if (record.magic != LogDescriptor || head + 1 + record.count > end)
+            break;
+        if (replay)
+        {
+            disk->Transfer(head + 1, record.count, images, FALSE);
+            for (int i = 0; i < record.count; i++)
+            {
+                if (revokedIn[record.sectors[i]] >= seq)
+                    continue; // 之後被 free 掉了
+                disk->Transfer(record.sectors[i], 1, &images[i * SectorSize], TRUE);
+                replayed++;
+            }
+        }
+        head += 1 + record.count;
+    }
+    return seq;
+}
+
+//----------------------------------------------------------------------
+// Journal::Begin/End
+// 	An update to the metadata starts, or is done, in the current
+//	thread; only the writes of threads in an update are logged.  When
+//	no thread is left in one, the group is committed if it is half
+//	full (so that the next update fits), or if it has been gathering
+//	for CommitTicks.
+//
+//	An End that leaves another thread's update going cannot commit,
+//	so the group may be more than half full when the next update
+//	begins; it is committed then, before anything is added to it.
+//	The End that leaves none going also wakes up any Sync waiting
+//	for that.
+//----------------------------------------------------------------------
+
+void Journal::Begin()
+{
+    if (depth == 0 && count > maxCount / 2)
+    {
+        commitLock->Acquire();
+        if (depth == 0 && count > maxCount / 2)
+            Commit(); // 剩下的空間不一定放得下這個 update
+        commitLock->Release();
+    }
+    if (depth++ == 0 && count == 0)
+        groupStart = kernel->stats->totalTicks;
+    kernel->currentThread->updateDepth++;
+}
+
+void Journal::End()
+{
+    ASSERT(depth > 0 && kernel->currentThread->updateDepth > 0);
+    kernel->currentThread->updateDepth--;
+    if (--depth > 0)
+        return;
+    bool commit = count > maxCount / 2 ||
+        (count > 0 && kernel->stats->totalTicks - groupStart >= CommitTicks);
+    if (commit || syncWaiting > 0)
+    {
+        commitLock->Acquire();
+        if (commit)
+            Commit();
+        updatesDone->Broadcast(commitLock);
+        commitLock->Release();
+    }
+}
+
+//----------------------------------------------------------------------
+// Journal::Note
+// 	"data" is the new contents of "sectorNumber", just written into
+//	the cache.  Log it if the thread writing it is in an update, or
+//	if the group already holds an older image of it (which would
+//	otherwise be replayed over the new one).  File data that other
+//	threads write meanwhile goes to the cache as usual.  Return TRUE
+//	if it was logged; the caller pins the buffer then.
+//
+//	An update too big for one group logs only what fits; the rest
+//	is written like data, and that update is not atomic.
+//
+//	A sector the group revoked, and now logs again, is in use once
+//	more: the group's own image is replayed after any older one, so
+//	the revoke is dropped.
+//
+//	Called with the cache lock held, so it must not wait.
+//----------------------------------------------------------------------
+
+bool Journal::Note(int sectorNumber, char *data)
+{
+    int i = Find(sectorNumber);
+
+    if (i == count)
+    {
+        if (kernel->currentThread->updateDepth == 0 || count == maxCount)
+            return FALSE;
+        homes[count++] = sectorNumber;
+        for (int j = 0; j < revokeCount; j++)
+            if (revokes[j] == sectorNumber)
+            {
+                revokes[j] = revokes[--revokeCount];
+                break;
+            }
+    }
+    bcopy(data, &images[i * SectorSize], SectorSize);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Journal::Revoke
+// 	"sectorNumber" has been freed by the update going on.  Its image
+//	in the group being gathered, if any, is dropped.  If a group in
+//	the log holds one, the group being gathered revokes the sector,
+//	so that Recover does not write that image over whatever the
+//	sector holds by then (file data, say, which is not logged).
+//
+//	If there are more such sectors than the group has room for, the
+//	log is emptied before the group is committed instead; then
+//	there is nothing left to revoke.
+//
+//	Called with the cache lock held, like Note.
+//----------------------------------------------------------------------
+
+void Journal::Revoke(int sectorNumber)
+{
+    int i = Find(sectorNumber);
+
+    if (i < count)
+    { // 不用寫進 log 了，拿最後一個補這個位置
+        count--;
+        homes[i] = homes[count];
+        bcopy(&images[count * SectorSize], &images[i * SectorSize], SectorSize);
+    }
+    if (!inLog->Test(sectorNumber))
+        return;
+    for (i = 0; i < revokeCount; i++)
+        if (revokes[i] == sectorNumber)
+            return;
+    if (revokeCount < MaxGroupSectors)
+        revokes[revokeCount++] = sectorNumber;
+    else
+        revokesLost = TRUE;
+}
+
+//----------------------------------------------------------------------
+// Journal::Logged
+// 	Return TRUE if the group being gathered holds an image of
+//	"sectorNumber", so its buffer must stay pinned even once an
+//	older group with it is committed.  Called with the cache lock
+//	held, like Note.
+//----------------------------------------------------------------------
+
+bool Journal::Logged(int sectorNumber)
+{
+    return Find(sectorNumber) < count;
+}
+
+//----------------------------------------------------------------------
+// Journal::Committing
+// 	Return TRUE if the group being written to the log holds an image
+//	of "sectorNumber", so its buffer is let go when that group is in.
+//----------------------------------------------------------------------
+
+bool Journal::Committing(int sectorNumber)
+{
+    for (int i = 0; i < commitCount; i++)
+        if (commitHomes[i] == sectorNumber)
+            return TRUE;
+    return FALSE;
+}
+
+//----------------------------------------------------------------------
+// Journal::Read
+// 	Without a cache, the newest contents of a logged sector are only
+//	here until its group is committed and written home.  Copy them
+//	into "data" and return TRUE if so; the group being gathered is
+//	newer than the one being committed.  Called with the cache lock
+//	held, like Note.
+//----------------------------------------------------------------------
+
+bool Journal::Read(int sectorNumber, char *data)
+{
+    int i = Find(sectorNumber);
+
+    if (i < count)
+    {
+        bcopy(&images[i * SectorSize], data, SectorSize);
+        return TRUE;
+    }
+    for (i = 0; i < commitCount; i++)
+        if (commitHomes[i] == sectorNumber)
+        {
+            bcopy(&commitImages[i * SectorSize], data, SectorSize);
+            return TRUE;
+        }
+    return FALSE;
+}
+
+int Journal::Find(int sectorNumber)
+{
+    int i;
+
+    for (i = 0; i < count && homes[i] != sectorNumber; i++)
+        ;
+    return i;
+}
+
+//----------------------------------------------------------------------
+// Journal::Sync
+// 	Commit the group being gathered, and write everything home, so
+//	that the log is empty.  Called when Nachos halts, and by the
+//	Sync and Fsync system calls.
+//
+//	Half an update must not be committed, so if other threads are
+//	in the middle of one, wait for them to end first; once Sync
+//	returns, everything done before it is on disk.  The caller's
+//	own update (if it is in one) is left for its End to commit.
+//----------------------------------------------------------------------
+
+void Journal::Sync()
+{
+    commitLock->Acquire();
+    syncWaiting++;
+    while (depth > kernel->currentThread->updateDepth)
+        updatesDone->Wait(commitLock);
+    syncWaiting--;
+    if (depth == 0)
+        Commit();
+    Checkpoint();
+    commitLock->Release();
+}
+
+//----------------------------------------------------------------------
+// Journal::Commit
+// 	Append the group to the log: its descriptors and sector images,
+//	in as few disk requests as possible, and then, once those are on
+//	disk, the commit record.  The logged buffers are then let go, to
+//	reach their home sectors whenever the cache writes them back;
+//	without a cache, the images are written home right away.
+//
+//	The group is set aside before the first disk request, and a new
+//	one starts: updates made while the log is being written go into
+//	that one, and do not change what is being committed.
+//
+//	If the log has no room for the group, or the group lost track of
+//	some sectors it should revoke, the log is emptied first, while
+//	"sequence" is still the group's own, so that the LogStart record
+//	written then matches the first group in the new log (this one,
+//	or the one Checkpoint carries over).  Called with commitLock
+//	held.
+//----------------------------------------------------------------------
+
+void Journal::Commit()
+{
+    char *buf;
+    LogRecord *record;
+    int *groupHomes = homes;
+    char *groupImages = images;
+    int *groupRevokes = revokes;
+    int groupCount = count;
+    int groupSequence = sequence;
+    int groupRevokeCount;
+    int i, n, needed;
+
+    if (groupCount == 0 && revokeCount == 0)
+        return;
+    needed = divRoundUp(groupCount, SectorsPerRecord) + groupCount +
+             divRoundUp(revokeCount, SectorsPerRecord) + 1;
+    if (revokesLost || head + needed > firstSector + numSectors)
+    { // 先清空 log；sequence 還沒加，LogStart 才會是這組的
+        Checkpoint();
+        groupCount = count; // it may have grown meanwhile
+        groupSequence = sequence; // or come after a carried-over group
+    }
+    // 換一組新的給 Note，這組寫進 log 的時候就不會再變了
+    homes = commitHomes;
+    images = commitImages;
+    revokes = commitRevokes;
+    commitHomes = groupHomes;
+    commitImages = groupImages;
+    commitRevokes = groupRevokes;
+    commitCount = groupCount;
+    groupRevokeCount = revokeCount;
+    count = 0;
+    revokeCount = 0;
+    sequence++;
+    groupStart = kernel->stats->totalTicks;
+    for (i = 0; i < groupCount; i++)
+        inLog->Mark(groupHomes[i]);
+
+    buf = new char[(1 + SectorsPerRecord) * SectorSize];
+    record = (LogRecord *)buf;
+    n = divRoundUp(groupRevokeCount, SectorsPerRecord);
+    needed = divRoundUp(groupCount, SectorsPerRecord) + groupCount + n + 1;
+    ASSERT(head + needed <= firstSector + numSectors);
+
+    WriteImages(groupHomes, groupImages, groupCount, groupSequence);
+    // revoke record 後面沒有 image，全部一次寫完
+    n = divRoundUp(groupRevokeCount, SectorsPerRecord);
+    ASSERT(n <= 1 + SectorsPerRecord);
+    for (i = 0; i < n; i++)
+    {
+        record = (LogRecord *)&buf[i * SectorSize];
+        bzero((char *)record, SectorSize);
+        record->magic = LogRevoke;
+        record->sequence = groupSequence;
+        record->count = min(groupRevokeCount - i * SectorsPerRecord, SectorsPerRecord);
+        bcopy(&groupRevokes[i * SectorsPerRecord], record->sectors,
+              record->count * sizeof(int));
+    }
+    if (n > 0)
+    {
+        disk->Transfer(head, n, buf, TRUE);
+        head += n;
+    }
+    WriteRecord(LogCommit, groupSequence);
+    DEBUG(dbgFile, "Committed group " << groupSequence << ", " << groupCount
+                   << " sectors, " << groupRevokeCount << " revoked");
+
+    if (disk->numBlocks == 0)
+    { // 沒有 cache 幫忙寫回，現在寫；寫完才讓等著的人寫這些 sector
+        for (i = 0; i < groupCount; i++)
+            disk->Transfer(groupHomes[i], 1, &groupImages[i * SectorSize], TRUE);
+        disk->lock->Acquire();
+        commitCount = 0;
+        disk->blockReady->Broadcast(disk->lock);
+        disk->lock->Release();
+    }
+    else
+    {
+        commitCount = 0; // Revoke may let its buffers go from now on
+        for (i = 0; i < groupCount; i++)
+            disk->Unpin(groupHomes[i]);
+    }
+    kernel->stats->numLogGroups++;
+    kernel->stats->numLogSectors += needed;
+    delete[] buf;
+}
+
+//----------------------------------------------------------------------
+// Journal::Checkpoint
+// 	Write every committed sector home (along with whatever else is
+//	dirty in the cache), so the log can start over from the top.
+//	With no image left in the log, there is nothing to revoke.
+//
+//	Buffers of the group still being gathered stay pinned, so a
+//	sector that group logs again is not home yet in the version the
+//	log holds.  Those images are read back out of the log and go
+//	into the new one, as a committed group of their own, before
+//	the log is let go; a crash then still finds them.  Called with
+//	commitLock held.
+//----------------------------------------------------------------------
+
+void Journal::Checkpoint()
+{
+    LogRecord record;
+    int *carried = NULL;
+    char *carriedImages = NULL;
+    int n = 0;
+
+    disk->WriteBackAll();
+    if (head == firstSector + 1)
+        return; // nothing in the log
+    if (disk->numBlocks > 0)
+    { // 沒有 cache 的話，commit 的時候就寫回去了
+        carried = new int[MaxGroupSectors];
+        disk->lock->Acquire();
+        for (int i = 0; i < count; i++)
+            if (inLog->Test(homes[i]))
+                carried[n++] = homes[i];
+        disk->lock->Release();
+    }
+    if (n > 0)
+    { // 後面的 group 比較新，最後找到的那個才算
+        carriedImages = new char[n * SectorSize];
+        for (int at = firstSector + 1; at < head;)
+        {
+            disk->Transfer(at, 1, (char *)&record, FALSE);
+            if (record.magic != LogDescriptor)
+            {
+                at++;
+                continue;
+            }
+            for (int i = 0; i < record.count; i++)
+                for (int j = 0; j < n; j++)
+                    if (record.sectors[i] == carried[j])
+                        disk->Transfer(at + 1 + i, 1, &carriedImages[j * SectorSize], FALSE);
+            at += 1 + record.count;
+        }
+    }
+    head = firstSector + 1;
+    WriteRecord(LogStart, sequence);
+    delete inLog;
+    inLog = new Bitmap(NumSectors);
+    revokeCount = 0;
+    revokesLost = FALSE;
+    if (n > 0)
+    {
+        WriteImages(carried, carriedImages, n, sequence);
+        WriteRecord(LogCommit, sequence);
+        for (int i = 0; i < n; i++)
+            inLog->Mark(carried[i]);
+        DEBUG(dbgFile, "Carried " << n << " sectors over into group " << sequence);
+        sequence++;
+    }
+    delete[] carried;
+    delete[] carriedImages;
+    kernel->stats->numCheckpoints++;
+}
+
+//----------------------------------------------------------------------
+// Journal::SelfTest
+// 	Commit one-sector groups, each with new contents for the last
+//	sector of the disk, until the log is full and wraps around.  Then
+//	crash: put the old contents back in the home sector, as if the
+//	cache never wrote the last group home, and Recover.  The sector
+//	must hold what that group logged.
+//
+//	Then commit a group that logs the sector, and one that frees it
+//	(as removing a file frees its header); write file data to it, as
+//	if it had been handed out again, and crash once the data is
+//	home.  Recover must leave the data alone.  The sector's old
+//	contents are restored at the end, so the file system is not
+//	disturbed.
+//----------------------------------------------------------------------
+
+void Journal::SelfTest()
+{
+    char orig[SectorSize], data[SectorSize], check[SectorSize];
+    int sector = NumSectors - 1;
+    int checkpoints = kernel->stats->numCheckpoints;
+    int groups = 0;
+    bool replayed, kept;
+
+    disk->ReadSector(sector, orig);
+    while (kernel->stats->numCheckpoints == checkpoints)
+    { // 一直 commit 到 log 滿了，繞回開頭
+        bzero(data, SectorSize);
+        sprintf(data, "journal test group %d", ++groups);
+        Begin();
+        disk->WriteSector(sector, data);
+        End();
+        commitLock->Acquire();
+        Commit();
+        commitLock->Release();
+    }
+
+    disk->Transfer(sector, 1, orig, TRUE); // crash
+    Recover();
+    disk->Transfer(sector, 1, check, FALSE);
+    replayed = (memcmp(check, data, SectorSize) == 0);
+    cout << "Journal test: " << groups << " groups committed, the last after "
+         << "the log wrapped; " << (replayed ? "replayed" : "NOT replayed")
+         << " after the crash\n";
+
+    bzero(data, SectorSize);
+    strcpy(data, "journal test metadata");
+    Begin();
+    disk->WriteSector(sector, data);
+    End();
+    commitLock->Acquire();
+    Commit();
+    commitLock->Release();
+    Begin();
+    disk->Revoke(sector); // 這組把它 free 掉
+    End();
+    commitLock->Acquire();
+    Commit();
+    commitLock->Release();
+    bzero(data, SectorSize);
+    strcpy(data, "journal test file data");
+    disk->WriteSector(sector, data); // 不在 update 裡，不會 log
+    disk->Transfer(sector, 1, data, TRUE); // crash
+    Recover();
+    disk->Transfer(sector, 1, check, FALSE);
+    kept = (memcmp(check, data, SectorSize) == 0);
+    cout << "Journal test: a logged sector freed and reused for data was "
+         << (kept ? "left alone" : "OVERWRITTEN") << " by the recovery\n";
+
+    Begin();
+    disk->WriteSector(sector, orig);
+    End();
+    Sync();
+    ASSERT(replayed && kept);
+}
+
+//----------------------------------------------------------------------
+// Journal::WriteImages
+// 	Write "n" sector images, "data" holding them back to back, at the
+//	head of the log, each run of them after the descriptor listing
+//	their home sectors.
+//----------------------------------------------------------------------
+
+void Journal::WriteImages(int *sectors, char *data, int n, int seq)
+{
+    char *buf = new char[(1 + SectorsPerRecord) * SectorSize];
+    LogRecord *record = (LogRecord *)buf;
+    int k;
+
+    for (int i = 0; i < n; i += k)
+    {
+        k = min(n - i, SectorsPerRecord);
+        bzero(buf, SectorSize);
+        record->magic = LogDescriptor;
+        record->sequence = seq;
+        record->count = k;
+        bcopy(&sectors[i], record->sectors, k * sizeof(int));
+        bcopy(&data[i * SectorSize], &buf[SectorSize], k * SectorSize);
+        disk->Transfer(head, 1 + k, buf, TRUE);
+        head += 1 + k;
+    }
+    delete[] buf;
+}
+
+//----------------------------------------------------------------------
+// Journal::WriteRecord
+// 	Write a commit record at the head of the log, or the LogStart
+//	record in the first sector of the region.
+//----------------------------------------------------------------------
+
+void Journal::WriteRecord(int magic, int seq)
+{
+    LogRecord record;
+
+    bzero((char *)&record, sizeof(record));
+    record.magic = magic;
+    record.sequence = seq;
+    if (magic == LogStart)
+        disk->Transfer(firstSector, 1, (char *)&record, TRUE);
+    else
+        disk->Transfer(head++, 1, (char *)&record, TRUE);
 }
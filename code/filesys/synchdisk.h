@@ -14,6 +14,160 @@
 #include "disk.h"
 #include "synch.h"
 #include "callback.h"
+#include "list.h"
+#include "bitmap.h"
+
+// Default number of sectors kept in the buffer cache.  Can be changed
+// with the "-bc" command line flag; "-bc 0" turns the cache off.  A
+// smaller cache than MinCacheSize (below) is not allowed.
+const int DefaultCacheSize = 1024;
+
+// The flusher thread writes a dirty buffer back once it has been dirty
+// for FlushTicks, and starts writing early whenever more than
+// DirtyPercent of the cache is dirty (then it goes on until less
+// than half that is left).
+const int FlushTicks = 1000000;
+const int DirtyPercent = 25;
+
+// The following class defines one buffer of the disk block cache.
+// Each buffer holds a copy of one disk sector.
+
+class CacheBlock
+{
+public:
+    int sector;           // Disk sector held here, -1 if unused
+    bool dirty;           // Modified since it was last written to disk?
+    bool referenced;      // Used since the clock hand last passed?
+    bool busy;            // Disk I/O in progress on this buffer?
+    bool prefetched;      // Read ahead, and not asked for yet?
+    bool pinned;          // Logged in a group that is not yet
+                          // committed; must not go to disk
+    int dirtySince;       // When it last went from clean to dirty
+    CacheBlock *hashNext; // Next block in the same hash bucket
+    char data[SectorSize];
+};
+
+// The following class defines one request waiting for the disk.
+
+class DiskRequest
+{
+public:
+    int sector;       // First sector of the run
+    int numSectors;   // Length of the run
+    char **data;      // One buffer per sector
+    bool writing;     // Write, rather than read?
+    int arrival;      // When the request was queued
+    Semaphore *done;  // Signalled when the disk is finished with it
+};
+
+// Limits on one group of updates in the journal: how many sectors it
+// may log, and how long (in ticks) it may stay open before it is
+// committed.
+const int MaxGroupSectors = 256;
+const int CommitTicks = 1000000;
+
+// The smallest buffer cache there may be: a group being gathered and
+// one being committed pin up to MaxGroupSectors each, and the rest
+// must still be enough for the sectors that are not logged.
+const int MinCacheSize = 3 * MaxGroupSectors;
+
+class SynchDisk;
+
+// The following class defines the journal of metadata updates.
+//
+// An update (creating a file, say) is bracketed by Begin and End; every
+// sector written in between is logged.  Updates are gathered into a
+// group, which is written to the log region in one go, and the group
+// is only then allowed to reach its home sectors.  After a crash,
+// Recover copies every group whose commit record reached the log to
+// where it belongs, so an update is on disk either entirely or not
+// at all.
+//
+// On disk, the first sector of the region holds the sequence number of
+// the first group in the log.  A group is one or more descriptors,
+// each followed by the sector images it lists, and then a commit
+// record.  A record with the wrong sequence number ends the log.
+//
+// A sector that is freed while an older group in the log holds an
+// image of it may be reused for file data, which is not logged; the
+// group that frees it carries a revoke record, so that Recover does
+// not copy the old image over the data.
+
+class Journal
+{
+public:
+    Journal(SynchDisk *disk, int firstSector, int numSectors);
+                // The log lives in "numSectors" sectors
+                // starting at "firstSector"
+    ~Journal();
+
+    void Format();  // Start an empty log on a new disk
+    void Recover(); // Replay the committed groups
+
+    void Begin();   // An update starts
+    void End();     // and is done; commit the group
+                    // if it is big or old enough
+    bool Note(int sectorNumber, char *data);
+                    // Log the new contents of a sector, if
+                    // an update is going on (or it is
+                    // logged already); TRUE if it was
+    void Revoke(int sectorNumber);
+                    // It was freed; older images of it
+                    // must not be replayed
+    void Sync();    // Wait for other threads' updates,
+                    // commit, and write everything home
+    bool Logged(int sectorNumber);
+                    // Is it in the group being gathered?
+    bool Committing(int sectorNumber);
+                    // or in the one being committed?
+    bool Read(int sectorNumber, char *data);
+                    // Copy out its logged image, if it
+                    // has one that is not home yet
+    void SelfTest(); // Wrap the log around, crash, and
+                     // recover; the same after a logged
+                     // sector is freed and reused
+
+private:
+    SynchDisk *disk;
+    int firstSector;    // Sector holding the sequence number
+    int numSectors;     // Size of the region, with that sector
+    int head;           // Where the next record goes
+    int sequence;       // Number of the group being gathered
+    int depth;          // Updates begun and not ended, by
+                        // any thread
+    int groupStart;     // When the group's first update began
+    int maxCount;       // Most sectors a group may log
+
+    int count;          // Sectors logged in the group
+    int *homes;         // Where each of them belongs
+    char *images;       // Their contents, back to back
+    int revokeCount;    // Sectors the group revokes
+    int *revokes;       // and which they are
+    bool revokesLost;   // More than fit; the log must be
+                        // emptied before the group goes in
+    int commitCount;    // The same, for the group being
+    int *commitHomes;   // written to the log
+    char *commitImages;
+    int *commitRevokes;
+    Bitmap *inLog;      // Sectors some group in the log
+                        // (or being written to it) holds
+    Lock *commitLock;   // Held while writing to the log
+    Condition *updatesDone; // Signalled when no update is
+                            // left going, if a Sync waits
+    int syncWaiting;    // Threads in Sync waiting for it
+
+    int Find(int sectorNumber); // Its place in the group
+    int ScanLog(int seq, int stop, int *revokedIn, bool replay);
+                        // Walk the groups in the log
+    void Commit();      // Write the group to the log
+    void Checkpoint();  // Write logged sectors home, and
+                        // empty the log (but for those still
+                        // pinned)
+    void WriteImages(int *sectors, char *data, int n, int seq);
+                        // Write descriptors and sector images
+    void WriteRecord(int magic, int seq);
+                        // Write a commit or LogStart record
+};
 
 // The following class defines a "synchronous" disk abstraction.
 // As with other I/O devices, the raw physical disk is an asynchronous device --
@@ -24,12 +178,27 @@
 //
 // This class provides the abstraction that for any individual thread
 // making a request, it waits around until the operation finishes before
-// returning.
+// returning.  Requests from many threads may be outstanding at once;
+// they wait in a queue, and each time the disk becomes free the next
+// one is picked according to the scheduling policy.
+//
+// Sectors are kept in a write-back buffer cache.  Reads that hit in the
+// cache, and all writes, return without touching the disk; a modified
+// sector goes to disk only when its buffer is reused (chosen by the
+// CLOCK algorithm), or when Flush is called.  Runs of consecutive
+// sectors are read and written with one multi-sector disk request.
+// Once the file system starts a journal, sectors written during an
+// update are pinned in the cache until their group is in the log
+// (without a cache, the journal holds on to them itself).
+// A flusher thread writes dirty buffers back in the background, so
+// that they seldom have to be written when the buffer is wanted.
 
 class SynchDisk : public CallBackObj
 {
 public:
-    SynchDisk();  // Initialize a synchronous disk,
+    SynchDisk(int cacheSize = DefaultCacheSize,
+              DiskSchedPolicy policy = DiskCSCAN);
+                  // Initialize a synchronous disk,
                   // by initializing the raw Disk.
     ~SynchDisk(); // De-allocate the synch disk data
 
@@ -41,16 +210,98 @@ public:
     // then wait until the request is done.
     void WriteSector(int sectorNumber, char *data);
 
+    void ReadSectors(int sectorNumber, int numSectors, char *data,
+                     int readAhead = 0);
+    // Read/write "numSectors" consecutive
+    // sectors; "data" holds them back to
+    // back.  Sectors that are not cached
+    // move in as few disk requests as
+    // possible.  A read can also bring
+    // the next "readAhead" sectors into
+    // the cache in the same requests.
+    void WriteSectors(int sectorNumber, int numSectors, char *data);
+    void Prefetch(int *sectors, int numSectors);
+    // Bring scattered sectors into the
+    // cache in order of sector number;
+    // "sectors" gets sorted
+
+    void Flush(); // Write every modified cached sector
+                  // back to disk
+
+    void StartFlusher(); // Fork the flusher thread
+    void WakeFlusher();  // Let it run, if buffers have been
+                         // dirty too long or too many are
+
+    void StartFormat(); // Erase the disk; until EndFormat,
+    void EndFormat();   // I/O takes no simulated time
+
+    void StartJournal(int firstSector, int numSectors, bool format);
+                      // Log metadata updates in the given
+                      // region; recover it unless "format"
+    void BeginUpdate(); // Bracket an update to the file
+    void EndUpdate();   // system metadata; see Journal
+    void Revoke(int sectorNumber); // A sector has been freed
+
     void CallBack(); // Called by the disk device interrupt
                      // handler, to signal that the
                      // current disk operation is complete.
 
+    void SelfTest(); // Several threads reading scattered
+                     // sectors at once
+    void JournalTest(); // Crash and recover the journal
+
 private:
+    friend class Journal; // pins buffers, and writes the log
+    friend void FlusherThread(void *arg);
+
     Disk *disk;           // Raw disk device
-    Semaphore *semaphore; // To synchronize requesting thread
-                          // with the interrupt handler
-    Lock *lock;           // Only one read/write request
-                          // can be sent to the disk at a time
+    Journal *journal;     // Metadata log, if the file system
+                          // started one
+    Lock *lock;           // Protects the cache; not held
+                          // while waiting for the disk
+    Condition *blockReady; // Signalled when a busy buffer
+                           // finishes its I/O
+
+    DiskSchedPolicy policy;     // How to pick the next request
+    List<DiskRequest *> *queue; // Requests waiting for the disk
+    DiskRequest *active;        // Request the disk is working on
+    bool formatting;            // Between StartFormat and EndFormat?
+
+    int numBlocks;           // Number of buffers in the cache
+    CacheBlock *blocks;      // The buffers
+    CacheBlock **hashTable;  // Buffers hashed by sector number
+    int clockHand;           // Next buffer the CLOCK looks at
+    int numDirty;            // Dirty buffers that are not pinned
+    int oldestDirty;         // No later than the dirtySince of
+                             // any of them
+    Semaphore *flushWanted;  // The flusher waits here for work
+    bool flusherIdle;        // and is waiting?
+
+    CacheBlock *Lookup(int sectorNumber); // Find a cached sector
+    CacheBlock *GetBlock(int sectorNumber, bool canWait);
+                                            // Pick a buffer for a
+                                            // sector that is not cached
+    void Unhash(CacheBlock *block);         // Take a buffer out of the
+                                            // hash table
+    void WriteBackRun(CacheBlock *block); // Write a dirty buffer,
+                                          // with its dirty neighbours
+    void WriteBackAll();                  // Write every dirty buffer
+                                          // that is not pinned
+    void WriteBackOld();                  // The flusher's round
+    void CountDirty(CacheBlock *block);   // A buffer may go to disk now
+    void Unpin(int sectorNumber);         // Its group is in the log
+    void Transfer(int sectorNumber, int numSectors, char *data,
+                  bool writing);          // Move sectors straight to or
+                                          // from the disk
+    void ReadUncached(int sectorNumber, int numSectors, char *data);
+    void WriteUncached(int sectorNumber, int numSectors, char *data);
+                                          // The same, with a journal
+                                          // but no cache
+
+    void DoRequest(int sectorNumber, int numSectors, char **data,
+                   bool writing); // Queue a disk request and wait for it
+    DiskRequest *NextRequest();   // Remove the request to serve next
+    void Dispatch();              // Start the next request on the disk
 };
 
 #endif // SYNCHDISK_H
@@ -10,6 +10,33 @@
 #include "debug.h"
 #include "bitmap.h"
 
+// Index of the lowest set bit of a non-zero word, and the number of
+// set bits in a word.  gcc has instructions for both.
+
+#ifdef __GNUC__
+#define LowestBit(word) __builtin_ctz(word)
+#define BitsSet(word) __builtin_popcount(word)
+#else
+static int LowestBit(unsigned int word)
+{
+    int n = 0;
+    while (!(word & 1))
+    {
+        word >>= 1;
+        n++;
+    }
+    return n;
+}
+
+static int BitsSet(unsigned int word)
+{
+    int n = 0;
+    for (; word != 0; word &= word - 1)
+        n++;
+    return n;
+}
+#endif
+
 //----------------------------------------------------------------------
 // BitMap::BitMap
 // 	Initialize a bitmap with "numItems" bits, so that every bit is clear.
@@ -31,10 +58,8 @@ Bitmap::Bitmap(int numItems)
     {
         map[i] = 0; // initialize map to keep Purify happy
     }
-    for (i = 0; i < numBits; i++)
-    {
-        Clear(i);
-    }
+    numClear = numBits;
+    hint = 0;
 }
 
 //----------------------------------------------------------------------
@@ -58,7 +83,12 @@ void Bitmap::Mark(int which)
 {
     ASSERT(which >= 0 && which < numBits);
 
-    map[which / BitsInWord] |= 1 << (which % BitsInWord);
+    if (!Test(which))
+    {
+        numClear--;
+        map[which / BitsInWord] |= 1 << (which % BitsInWord);
+        BitChanged(which, TRUE);
+    }
 
     ASSERT(Test(which));
 }
@@ -74,7 +104,12 @@ void Bitmap::Clear(int which)
 {
     ASSERT(which >= 0 && which < numBits);
 
-    map[which / BitsInWord] &= ~(1 << (which % BitsInWord));
+    if (Test(which))
+    {
+        numClear++;
+        map[which / BitsInWord] &= ~(1 << (which % BitsInWord));
+        BitChanged(which, FALSE);
+    }
 
     ASSERT(!Test(which));
 }
@@ -102,24 +137,176 @@ bool Bitmap::Test(int which) const
 
 //----------------------------------------------------------------------
 // Bitmap::FindAndSet
-// 	Return the number of the first bit which is clear.
+// 	Return the number of a bit which is clear.
 //	As a side effect, set the bit (mark it as in use).
 //	(In other words, find and allocate a bit.)
 //
+//	The search starts where the last one left off (next fit), and
+//	wraps around to the beginning.
+//
 //	If no bits are clear, return -1.
 //----------------------------------------------------------------------
 
 int Bitmap::FindAndSet()
 {
-    for (int i = 0; i < numBits; i++)
+    int which;
+
+    if (numClear == 0)
+        return -1;
+    which = NextClear(hint * BitsInWord);
+    if (which == numBits)
+        which = NextClear(0);
+    ASSERT(which < numBits);
+    Mark(which);
+    hint = which / BitsInWord;
+    return which;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::FindAndSetRange
+// 	Look for a run of "numWanted" consecutive clear bits and set them.
+//	If there is no run that long, take the longest run of clear bits
+//	instead, so the caller can ask again for the rest.  Like
+//	FindAndSet, the search starts where the last one left off.
+//
+//	Return the number of the first bit in the run, and store the
+//	length of the run in "numFound".  If no bits are clear, return -1.
+//
+//	"numWanted" is the length of the run we would like
+//	"numFound" is set to the length of the run we got
+//----------------------------------------------------------------------
+
+int Bitmap::FindAndSetRange(int numWanted, int *numFound)
+{
+    int start = FindRun(numWanted, numFound);
+
+    if (start >= 0)
+        MarkRun(start, *numFound);
+    return start;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::FindAndSetRun
+// 	Look for a run of "numWanted" consecutive clear bits, set them,
+//	and return the first one.  Return -1 (and set nothing) if there
+//	is no run that long.
+//----------------------------------------------------------------------
+
+int Bitmap::FindAndSetRun(int numWanted)
+{
+    int found;
+    int start = FindRun(numWanted, &found);
+
+    if (found < numWanted)
+        return -1;
+    MarkRun(start, found);
+    return start;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::FindRun
+// 	Find the first run of "numWanted" clear bits at or after the hint,
+//	wrapping around to the beginning; if there is none, the longest
+//	run.  Set "numFound" to its length (at most numWanted) and return
+//	its first bit, or -1 if every bit is set.
+//
+//	Runs are found with NextClear/NextSet, which skip over whole words,
+//	so the cost is in the number of runs, not the number of bits.
+//----------------------------------------------------------------------
+
+int Bitmap::FindRun(int numWanted, int *numFound) const
+{
+    int bestStart = -1, bestLength = 0;
+    int start, end, from, limit;
+
+    ASSERT(numWanted > 0);
+
+    *numFound = 0;
+    if (numClear == 0)
+        return -1;
+    for (int pass = 0; pass < 2; pass++)
     {
-        if (!Test(i))
+        // first from the hint to the end, then from the beginning
+        from = (pass == 0) ? hint * BitsInWord : 0;
+        limit = (pass == 0) ? numBits : hint * BitsInWord;
+        while (from < limit)
         {
-            Mark(i);
-            return i;
+            start = NextClear(from);
+            if (start >= limit)
+                break;
+            end = NextSet(start);
+            if (end - start >= numWanted)
+            {
+                *numFound = numWanted;
+                return start;
+            }
+            if (end - start > bestLength)
+            {
+                bestStart = start;
+                bestLength = end - start;
+            }
+            from = end;
         }
     }
-    return -1;
+    *numFound = bestLength;
+    return bestStart;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::MarkRun
+// 	Set "length" bits starting at "start", and move the hint past them.
+//----------------------------------------------------------------------
+
+void Bitmap::MarkRun(int start, int length)
+{
+    for (int i = 0; i < length; i++)
+    {
+        Mark(start + i);
+    }
+    hint = (start + length) / BitsInWord;
+    if (hint >= numWords)
+        hint = 0;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::NextClear/NextSet
+// 	Return the first clear (set) bit at or after "from", or numBits if
+//	there is none.  Whole words that are all set (all clear) are
+//	skipped, and within a word the bit is found with LowestBit.
+//----------------------------------------------------------------------
+
+int Bitmap::NextClear(int from) const
+{
+    int w = from / BitsInWord;
+    unsigned int word;
+
+    if (from >= numBits)
+        return numBits;
+    word = ~map[w] & (~0u << (from % BitsInWord));
+    while (word == 0)
+    {
+        if (++w == numWords)
+            return numBits;
+        word = ~map[w];
+    }
+    return min(w * BitsInWord + LowestBit(word), numBits);
+}
+
+int Bitmap::NextSet(int from) const
+{
+    int w = from / BitsInWord;
+    unsigned int word;
+
+    if (from >= numBits)
+        return numBits;
+    word = map[w] & (~0u << (from % BitsInWord));
+    while (word == 0)
+    {
+        if (++w == numWords)
+            return numBits;
+        word = map[w];
+    }
+    return min(w * BitsInWord + LowestBit(word), numBits);
 }
 
 //----------------------------------------------------------------------
@@ -130,18 +317,48 @@ int Bitmap::FindAndSet()
 
 int Bitmap::NumClear() const
 {
+    return numClear;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::NumClear
+// 	Return the number of clear bits among the "length" bits starting
+//	at "start".  Whole words in the middle are counted with BitsSet.
+//----------------------------------------------------------------------
+
+int Bitmap::NumClear(int start, int length) const
+{
+    int end = min(start + length, numBits);
     int count = 0;
+    int i = start;
 
-    for (int i = 0; i < numBits; i++)
-    {
+    for (; i < end && (i % BitsInWord) != 0; i++)
+        if (!Test(i))
+            count++;
+    for (; i + BitsInWord <= end; i += BitsInWord)
+        count += BitsInWord - BitsSet(map[i / BitsInWord]);
+    for (; i < end; i++)
         if (!Test(i))
-        {
             count++;
-        }
-    }
     return count;
 }
 
+//----------------------------------------------------------------------
+// Bitmap::Recount
+// 	Count the clear bits again, a word at a time.  Needed when the
+//	contents of "map" have been replaced, e.g. read in from disk.
+//----------------------------------------------------------------------
+
+void Bitmap::Recount()
+{
+    numClear = numBits;
+    for (int i = 0; i < numWords; i++)
+    {
+        numClear -= BitsSet(map[i]);
+    }
+    hint = 0;
+}
+
 //----------------------------------------------------------------------
 // Bitmap::Print
 // 	Print the contents of the bitmap, for debugging.
@@ -193,4 +410,22 @@ void Bitmap::SelfTest()
     {
         Clear(i);
     }
+    ASSERT(NumClear() == numBits);
+
+    // runs, with a hole that is too small in the way
+    hint = 0;
+    ASSERT(FindAndSetRun(3) == 0);
+    Mark(5);
+    ASSERT(FindAndSetRun(4) == 6);
+    ASSERT(NumClear() == numBits - 8);
+    Clear(0);
+    Clear(1);
+    Clear(2);
+    hint = 0;
+    ASSERT(FindAndSetRun(numBits) == -1);
+    for (i = 0; i < numBits; i++)
+    {
+        Clear(i);
+    }
+    hint = 0;
 }
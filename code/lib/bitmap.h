@@ -4,6 +4,9 @@
 //
 //	Represented as an array of unsigned integers, on which we do
 //	modulo arithmetic to find the bit we are interested in.
+//	Searches go a word at a time, skipping words that are all set
+//	(or all clear), and the number of clear bits is kept up to date
+//	so that it need not be counted.
 //
 //	The bitmap can be parameterized with with the number of bits being
 //	managed.
@@ -35,7 +38,7 @@ class Bitmap
 public:
     Bitmap(int numItems); // Initialize a bitmap, with "numItems" bits
                           // initially, all bits are cleared.
-    ~Bitmap();            // De-allocate bitmap
+    virtual ~Bitmap();    // De-allocate bitmap
 
     void Mark(int which);       // Set the "nth" bit
     void Clear(int which);      // Clear the "nth" bit
@@ -43,7 +46,19 @@ public:
     int FindAndSet();           // Return the # of a clear bit, and as a side
         // effect, set the bit.
         // If no bits are clear, return -1.
+    int FindAndSetRange(int numWanted, int *numFound);
+                          // Find a run of "numWanted" clear bits
+                          // (or, failing that, the longest run there
+                          // is), set them, and return the first one.
+                          // "numFound" gets the run length.
+                          // If no bits are clear, return -1.
+    int FindAndSetRun(int numWanted);
+                          // Same, but only an entire run of
+                          // "numWanted" bits will do; -1 if there
+                          // is none.
     int NumClear() const; // Return the number of clear bits
+    int NumClear(int start, int length) const;
+                          // Same, among "length" bits from "start"
 
     void Print() const; // Print contents of bitmap
     void SelfTest();    // Test whether bitmap is working
@@ -55,6 +70,23 @@ protected:
                        //  multiple of the number of bits in
                        //  a word)
     unsigned int *map; // bit storage
+    int numClear;      // number of clear bits
+    int hint;          // word where the next search starts
+                       // (next fit)
+
+    void Recount();    // Recompute numClear, after "map" has
+                       // been filled in wholesale
+
+    virtual void BitChanged(int which, bool set) {}
+                       // Called whenever a bit flips, so a
+                       // subclass can keep its own summaries
+
+private:
+    int NextClear(int from) const; // First clear/set bit at or after
+    int NextSet(int from) const;   // "from"; numBits if there is none
+    int FindRun(int numWanted, int *numFound) const;
+                                   // Where FindAndSetRange would look
+    void MarkRun(int start, int length); // Set a run of bits
 };
 
 #endif // BITMAP_H
@@ -32,6 +32,7 @@ const char dbgSys = 'u';                // systemcall
 const char rain = 'r';         // Ivan
 const char alice = 'c';        // alice
 const char size = 'S';         // show file size
+const char dbgStats = 'T';     // print performance statistics at halt
 
 class Debug {
   public:
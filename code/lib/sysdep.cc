@@ -30,6 +30,9 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <cerrno>
@@ -51,10 +54,6 @@ extern "C" {
 #include <signal.h>
 #include <sys/types.h>
 
-#ifndef NO_MPROT 
-#include <sys/mman.h>
-#endif
-
 // UNIX routines called by procedures in this file 
 
 #if defined CYGWIN
@@ -379,6 +378,41 @@ Lseek(int fd, int offset, int whence)
     ASSERT(retVal >= 0);
 }
 
+//----------------------------------------------------------------------
+// ReadFileAt/WriteFileAt
+// 	Read/write characters at "offset" in an open file, without using
+//	(or moving) the file's current location, so that it can be done
+//	from another host thread.  Abort on error.
+//----------------------------------------------------------------------
+
+void
+ReadFileAt(int fd, char *buffer, int nBytes, int offset)
+{
+    int retVal = pread(fd, buffer, nBytes, offset);
+    ASSERT(retVal == nBytes);
+}
+
+void
+WriteFileAt(int fd, char *buffer, int nBytes, int offset)
+{
+    int retVal = pwrite(fd, buffer, nBytes, offset);
+    ASSERT(retVal == nBytes);
+}
+
+//----------------------------------------------------------------------
+// Truncate
+// 	Make an open file "size" bytes long.  Bytes past the old end read
+//	as zeros, and take no space on the host disk until written.
+//	Abort on error.
+//----------------------------------------------------------------------
+
+void
+Truncate(int fd, int size)
+{
+    int retVal = ftruncate(fd, size);
+    ASSERT(retVal >= 0);
+}
+
 //----------------------------------------------------------------------
 // Tell
 // 	Report the current location within an open file.
@@ -396,6 +430,49 @@ Tell(int fd)
 }
 
 
+//----------------------------------------------------------------------
+// MapFile
+// 	Map the first "size" bytes of an open file into memory, shared,
+//	so that stores to the memory change the file.  Return NULL if
+//	the file cannot be mapped; the caller then falls back on
+//	Read/WriteFile.
+//----------------------------------------------------------------------
+
+char *
+MapFile(int fd, int size)
+{
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (addr == MAP_FAILED)
+        return NULL;
+    return (char *)addr;
+}
+
+//----------------------------------------------------------------------
+// SyncMappedFile
+// 	Wait until what was stored into a mapped file is in the file.
+//	Abort on error.
+//----------------------------------------------------------------------
+
+void
+SyncMappedFile(char *addr, int size)
+{
+    int retVal = msync(addr, size, MS_SYNC);
+    ASSERT(retVal >= 0);
+}
+
+//----------------------------------------------------------------------
+// UnmapFile
+// 	Undo MapFile.
+//----------------------------------------------------------------------
+
+void
+UnmapFile(char *addr, int size)
+{
+    int retVal = munmap(addr, size);
+    ASSERT(retVal >= 0);
+}
+
 //----------------------------------------------------------------------
 // Close
 // 	Close a file.  Abort on error.
@@ -409,6 +486,60 @@ Close(int fd)
     return retVal;
 }
 
+//----------------------------------------------------------------------
+// IsDirectory
+// 	Is "name" a UNIX directory?
+//----------------------------------------------------------------------
+
+bool
+IsDirectory(char *name)
+{
+    struct stat info;
+
+    return stat(name, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+//----------------------------------------------------------------------
+// MakeDirectory
+// 	Make a UNIX directory.  Return FALSE if it could not be made.
+//----------------------------------------------------------------------
+
+bool
+MakeDirectory(char *name)
+{
+    return mkdir(name, 0777) == 0;
+}
+
+//----------------------------------------------------------------------
+// OpenDir/NextDirEntry/CloseDir
+// 	Go through the names in a UNIX directory, in no particular order,
+//	leaving out "." and "..".  OpenDir returns NULL if "name"
+//	cannot be read; NextDirEntry returns NULL after the last name.
+//----------------------------------------------------------------------
+
+void *
+OpenDir(char *name)
+{
+    return opendir(name);
+}
+
+char *
+NextDirEntry(void *dir)
+{
+    struct dirent *entry;
+
+    while ((entry = readdir((DIR *)dir)) != NULL)
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+            return entry->d_name;
+    return NULL;
+}
+
+void
+CloseDir(void *dir)
+{
+    closedir((DIR *)dir);
+}
+
 //----------------------------------------------------------------------
 // Unlink
 // 	Delete a file.
@@ -49,9 +49,23 @@ extern void Read(int fd, char *buffer, int nBytes);
 extern int ReadPartial(int fd, char *buffer, int nBytes);
 extern void WriteFile(int fd, char *buffer, int nBytes);
 extern void Lseek(int fd, int offset, int whence);
+extern void ReadFileAt(int fd, char *buffer, int nBytes, int offset);
+extern void WriteFileAt(int fd, char *buffer, int nBytes, int offset);
+extern void Truncate(int fd, int size);
 extern int Tell(int fd);
 extern int Close(int fd);
 extern bool Unlink(char *name);
+extern bool IsDirectory(char *name);
+extern bool MakeDirectory(char *name);
+extern void *OpenDir(char *name);
+extern char *NextDirEntry(void *dir);
+extern void CloseDir(void *dir);
+
+// Map an open file into memory, for simulating the disk without a
+// system call per request
+extern char *MapFile(int fd, int size);
+extern void SyncMappedFile(char *addr, int size);
+extern void UnmapFile(char *addr, int size);
 
 // Other C library routines that are used by Nachos.
 // These are assumed to be portable, so we don't include a wrapper.
@@ -27,19 +27,27 @@ const int MagicNumber = 0x456789ab;
 const int MagicSize = sizeof(int);
 const int DiskSize = (MagicSize + (NumSectors * SectorSize));
 
+void *DiskHostWorker(void *arg); // body of the "-da" worker thread
+
 //----------------------------------------------------------------------
 // Disk::Disk()
 // 	Initialize a simulated disk.  Open the UNIX file (creating it
 //	if it doesn't exist), and check the magic number to make sure it's
 // 	ok to treat it as Nachos disk storage.
 //
+//	With the "-dm" flag, the whole file is then mapped into memory,
+//	and requests copy to and from the mapping rather than making a
+//	system call each.  The simulated timing is the same either way.
+//
+//	With "-da" (and no "-dm"), a host thread is started to do the
+//	reads/writes of the UNIX file in the background.
+//
 //	"toCall" -- object to call when disk read/write request completes
 //----------------------------------------------------------------------
 
 Disk::Disk(CallBackObj *toCall)
 {
     int magicNum;
-    int tmp = 0;
 
     DEBUG(dbgDisk, "Initializing the disk.");
     callWhenDone = toCall;
@@ -59,9 +67,32 @@ Disk::Disk(CallBackObj *toCall)
         magicNum = MagicNumber;
         WriteFile(fileno, (char *)&magicNum, MagicSize); // write magic number
 
-        // need to write at end of file, so that reads will not return EOF
-        Lseek(fileno, DiskSize - sizeof(int), 0);
-        WriteFile(fileno, (char *)&tmp, sizeof(int));
+        // make the file as long as the disk, so that reads will not
+        // return EOF; the host gives it no space until it is written
+        Truncate(fileno, DiskSize);
+    }
+    image = NULL;
+    if (kernel->mapDisk)
+    {
+        image = MapFile(fileno, DiskSize);
+        if (image == NULL)
+        {
+            DEBUG(dbgDisk, "Cannot map the disk, using read/write.");
+        }
+    }
+    hostWorker = (image == NULL) && kernel->asyncDisk;
+    if (hostWorker)
+    {
+        hostBuf = new char[MaxRequestSectors * SectorSize];
+        hostState = HostIdle;
+        pthread_mutex_init(&hostLock, NULL);
+        pthread_cond_init(&hostReady, NULL);
+        if (pthread_create(&hostThread, NULL, DiskHostWorker, this) != 0)
+        {
+            DEBUG(dbgDisk, "Cannot start the disk worker, using read/write.");
+            hostWorker = FALSE;
+            delete[] hostBuf;
+        }
     }
     active = FALSE;
 }
@@ -74,9 +105,88 @@ Disk::Disk(CallBackObj *toCall)
 
 Disk::~Disk()
 {
+    if (hostWorker)
+    { // no request is in progress, so the worker is waiting
+        pthread_mutex_lock(&hostLock);
+        hostState = HostQuit;
+        pthread_cond_broadcast(&hostReady);
+        pthread_mutex_unlock(&hostLock);
+        pthread_join(hostThread, NULL);
+        pthread_mutex_destroy(&hostLock);
+        pthread_cond_destroy(&hostReady);
+        delete[] hostBuf;
+    }
+    if (image != NULL)
+    {
+        SyncMappedFile(image, DiskSize);
+        UnmapFile(image, DiskSize);
+    }
     Close(fileno);
 }
 
+//----------------------------------------------------------------------
+// Disk::Sync()
+// 	Wait until every sector written so far is in the UNIX file.
+//	Writes go to the file at once unless the disk is mapped.
+//----------------------------------------------------------------------
+
+void Disk::Sync()
+{
+    if (image != NULL)
+        SyncMappedFile(image, DiskSize);
+}
+
+//----------------------------------------------------------------------
+// Disk::Erase()
+// 	Set every sector of the disk to zeros, by cutting the UNIX file
+//	back to its magic number and making it long again.  The host
+//	gives the zeros no space.  Takes no simulated time; this is for
+//	laying down a new file system.
+//----------------------------------------------------------------------
+
+void Disk::Erase()
+{
+    ASSERT(!active);
+    DEBUG(dbgDisk, "Erasing the disk.");
+    Truncate(fileno, MagicSize);
+    Truncate(fileno, DiskSize);
+}
+
+//----------------------------------------------------------------------
+// Disk::Copy()
+// 	Read/write a run of sectors right away, as ReadRequest/WriteRequest
+//	would, but taking no simulated time and causing no interrupt.
+//	The head does not move.  Used while a new file system is laid
+//	down, which is not part of the work being measured.
+//
+//	"sectorNumber" -- the first disk sector to read/write
+//	"numSectors" -- how many sectors, at most MaxRequestSectors
+//	"data" -- one buffer per sector
+//	"writing" -- write the sectors, rather than read them
+//----------------------------------------------------------------------
+
+void Disk::Copy(int sectorNumber, int numSectors, char **data, bool writing)
+{
+    int offset;
+
+    ASSERT(!active);
+    ASSERT((numSectors > 0) && (numSectors <= MaxRequestSectors));
+    ASSERT((sectorNumber >= 0) && (sectorNumber + numSectors <= NumSectors));
+
+    for (int i = 0; i < numSectors; i++)
+    {
+        offset = SectorSize * (sectorNumber + i) + MagicSize;
+        if (image != NULL && writing)
+            bcopy(data[i], &image[offset], SectorSize);
+        else if (image != NULL)
+            bcopy(&image[offset], data[i], SectorSize);
+        else if (writing)
+            WriteFileAt(fileno, data[i], SectorSize, offset);
+        else
+            ReadFileAt(fileno, data[i], SectorSize, offset);
+    }
+}
+
 //----------------------------------------------------------------------
 // Disk::PrintSector()
 // 	Dump the data in a disk read/write request, for debugging.
@@ -115,39 +225,120 @@ PrintSector(bool writing, int sector, char *data)
 
 void Disk::ReadRequest(int sectorNumber, char *data)
 {
-    int ticks = ComputeLatency(sectorNumber, FALSE);
+    ReadRequest(sectorNumber, 1, &data);
+}
 
-    ASSERT(!active); // only one request at a time
-    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+void Disk::WriteRequest(int sectorNumber, char *data)
+{
+    WriteRequest(sectorNumber, 1, &data);
+}
 
-    DEBUG(dbgDisk, "Reading from sector " << sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    Read(fileno, data, SectorSize);
-    if (debug->IsEnabled('d'))
-        PrintSector(FALSE, sectorNumber, data);
+//----------------------------------------------------------------------
+// Disk::ReadRequest/WriteRequest
+// 	Simulate a request to read/write a run of consecutive disk
+//	sectors.  The whole run is moved with one Lseek and one Read/Write
+//	on the UNIX file (or copied, if it is mapped), and completes with
+//	one interrupt.
+//
+//	The sectors need not be contiguous in memory: data[i] is the
+//	buffer for sector sectorNumber + i (a scatter/gather list).
+//
+//	"sectorNumber" -- the first disk sector to read/write
+//	"numSectors" -- how many sectors, at most MaxRequestSectors
+//	"data" -- one buffer per sector
+//----------------------------------------------------------------------
+
+void Disk::ReadRequest(int sectorNumber, int numSectors, char **data)
+{
+    int ticks = ComputeLatency(sectorNumber, numSectors, FALSE);
+    char *buf;
+
+    ASSERT(!active); // only one request at a time
+    ASSERT((numSectors > 0) && (numSectors <= MaxRequestSectors));
+    ASSERT((sectorNumber >= 0) && (sectorNumber + numSectors <= NumSectors));
+
+    DEBUG(dbgDisk, "Reading from sector " << sectorNumber << ", " << numSectors << " sectors");
+    if (image != NULL)
+    { // 直接從 mapping 複製，不用 system call
+        for (int i = 0; i < numSectors; i++)
+            bcopy(&image[SectorSize * (sectorNumber + i) + MagicSize], data[i], SectorSize);
+    }
+    else if (hostWorker)
+    { // the worker reads; the data is scattered at the interrupt
+        for (int i = 0; i < numSectors; i++)
+            hostData[i] = data[i];
+        StartHostIO(FALSE, sectorNumber, numSectors);
+    }
+    else if (numSectors == 1)
+    {
+        Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
+        Read(fileno, data[0], SectorSize);
+    }
+    else
+    { // one host read, then scatter
+        buf = new char[numSectors * SectorSize];
+        Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
+        Read(fileno, buf, numSectors * SectorSize);
+        for (int i = 0; i < numSectors; i++)
+            bcopy(&buf[i * SectorSize], data[i], SectorSize);
+        delete[] buf;
+    }
+    if (debug->IsEnabled('d') && !hostWorker)
+        for (int i = 0; i < numSectors; i++)
+            PrintSector(FALSE, sectorNumber + i, data[i]);
 
     active = TRUE;
-    UpdateLast(sectorNumber);
+    kernel->stats->numDiskSeekTracks += SeekDistance(sectorNumber, numSectors);
+    UpdateLast(sectorNumber, numSectors, ticks);
     kernel->stats->numDiskReads++;
+    kernel->stats->numDiskSectorsRead += numSectors;
     kernel->interrupt->Schedule(this, ticks, DiskInt);
 }
 
-void Disk::WriteRequest(int sectorNumber, char *data)
+void Disk::WriteRequest(int sectorNumber, int numSectors, char **data)
 {
-    int ticks = ComputeLatency(sectorNumber, TRUE);
+    int ticks = ComputeLatency(sectorNumber, numSectors, TRUE);
+    char *buf;
 
     ASSERT(!active);
-    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+    ASSERT((numSectors > 0) && (numSectors <= MaxRequestSectors));
+    ASSERT((sectorNumber >= 0) && (sectorNumber + numSectors <= NumSectors));
 
-    DEBUG(dbgDisk, "Writing to sector " << sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    WriteFile(fileno, data, SectorSize);
+    DEBUG(dbgDisk, "Writing to sector " << sectorNumber << ", " << numSectors << " sectors");
+    if (image != NULL)
+    {
+        for (int i = 0; i < numSectors; i++)
+            bcopy(data[i], &image[SectorSize * (sectorNumber + i) + MagicSize], SectorSize);
+    }
+    else if (hostWorker)
+    { // gather now, so the caller's buffers are free; the worker writes
+        for (int i = 0; i < numSectors; i++)
+            bcopy(data[i], &hostBuf[i * SectorSize], SectorSize);
+        StartHostIO(TRUE, sectorNumber, numSectors);
+    }
+    else if (numSectors == 1)
+    {
+        Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
+        WriteFile(fileno, data[0], SectorSize);
+    }
+    else
+    { // gather, then one host write
+        buf = new char[numSectors * SectorSize];
+        for (int i = 0; i < numSectors; i++)
+            bcopy(data[i], &buf[i * SectorSize], SectorSize);
+        Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
+        WriteFile(fileno, buf, numSectors * SectorSize);
+        delete[] buf;
+    }
     if (debug->IsEnabled('d'))
-        PrintSector(TRUE, sectorNumber, data);
+        for (int i = 0; i < numSectors; i++)
+            PrintSector(TRUE, sectorNumber + i, data[i]);
 
     active = TRUE;
-    UpdateLast(sectorNumber);
+    kernel->stats->numDiskSeekTracks += SeekDistance(sectorNumber, numSectors);
+    UpdateLast(sectorNumber, numSectors, ticks);
     kernel->stats->numDiskWrites++;
+    kernel->stats->numDiskSectorsWritten += numSectors;
     kernel->interrupt->Schedule(this, ticks, DiskInt);
 }
 
@@ -158,10 +349,96 @@ void Disk::WriteRequest(int sectorNumber, char *data)
 
 void Disk::CallBack()
 {
+    if (hostWorker)
+        FinishHostIO();
     active = FALSE;
     callWhenDone->CallBack();
 }
 
+//----------------------------------------------------------------------
+// Disk::StartHostIO()
+// 	With the "-da" flag, hand the UNIX read/write of a request to the
+//	worker thread, and return at once.  The simulation goes on (other
+//	threads run, other devices interrupt) while the host does the I/O;
+//	the request completes, as always, at its DiskInt.  The simulated
+//	time does not depend on how long the host takes.
+//
+//	For a write, the data is already in hostBuf.
+//----------------------------------------------------------------------
+
+void Disk::StartHostIO(bool writing, int sectorNumber, int numSectors)
+{
+    pthread_mutex_lock(&hostLock);
+    ASSERT(hostState == HostIdle);
+    hostWriting = writing;
+    hostSector = sectorNumber;
+    hostCount = numSectors;
+    hostState = HostQueued;
+    pthread_cond_broadcast(&hostReady);
+    pthread_mutex_unlock(&hostLock);
+}
+
+//----------------------------------------------------------------------
+// Disk::FinishHostIO()
+// 	At the DiskInt of a request handed to the worker, wait for the
+//	host to be done with it (usually it long since is), then give a
+//	read its data.
+//----------------------------------------------------------------------
+
+void Disk::FinishHostIO()
+{
+    pthread_mutex_lock(&hostLock);
+    while (hostState != HostDone)
+        pthread_cond_wait(&hostReady, &hostLock);
+    hostState = HostIdle;
+    pthread_mutex_unlock(&hostLock);
+
+    for (int i = 0; i < hostCount; i++)
+    {
+        if (!hostWriting)
+            bcopy(&hostBuf[i * SectorSize], hostData[i], SectorSize);
+        if (debug->IsEnabled('d'))
+            PrintSector(hostWriting, hostSector + i, &hostBuf[i * SectorSize]);
+    }
+}
+
+//----------------------------------------------------------------------
+// DiskHostWorker()
+// 	The body of the worker thread: a host (pthread) thread, not a
+//	Nachos one, so it must not touch anything but the request it is
+//	given.  Serve one request at a time, as the disk does, until told
+//	to quit.
+//----------------------------------------------------------------------
+
+void *DiskHostWorker(void *arg)
+{
+    Disk *disk = (Disk *)arg;
+    int offset, bytes;
+
+    pthread_mutex_lock(&disk->hostLock);
+    for (;;)
+    {
+        while (disk->hostState != HostQueued && disk->hostState != HostQuit)
+            pthread_cond_wait(&disk->hostReady, &disk->hostLock);
+        if (disk->hostState == HostQuit)
+            break;
+        offset = SectorSize * disk->hostSector + MagicSize;
+        bytes = SectorSize * disk->hostCount;
+        pthread_mutex_unlock(&disk->hostLock);
+
+        if (disk->hostWriting)
+            WriteFileAt(disk->fileno, disk->hostBuf, bytes, offset);
+        else
+            ReadFileAt(disk->fileno, disk->hostBuf, bytes, offset);
+
+        pthread_mutex_lock(&disk->hostLock);
+        disk->hostState = HostDone;
+        pthread_cond_broadcast(&disk->hostReady);
+    }
+    pthread_mutex_unlock(&disk->hostLock);
+    return NULL;
+}
+
 //----------------------------------------------------------------------
 // Disk::TimeToSeek()
 //	Returns how long it will take to position the disk head over the correct
@@ -189,6 +466,21 @@ int Disk::TimeToSeek(int newSector, int *rotation)
     return seek;
 }
 
+//----------------------------------------------------------------------
+// Disk::SeekDistance()
+//	Return how many tracks the head crosses to serve a request for
+//	"numSectors" sectors starting at newSector: the seek to the first
+//	track, plus the tracks the run itself spans.
+//----------------------------------------------------------------------
+
+int Disk::SeekDistance(int newSector, int numSectors)
+{
+    int newTrack = newSector / SectorsPerTrack;
+    int endTrack = (newSector + numSectors - 1) / SectorsPerTrack;
+
+    return abs(newTrack - lastSector / SectorsPerTrack) + (endTrack - newTrack);
+}
+
 //----------------------------------------------------------------------
 // Disk::ModuloDiff()
 // 	Return number of sectors of rotational delay between target sector
@@ -245,6 +537,25 @@ int Disk::ComputeLatency(int newSector, bool writing)
     return (seek + rotation + RotationTime);
 }
 
+//----------------------------------------------------------------------
+// Disk::ComputeLatency()
+// 	Return how long it will take to read/write "numSectors" consecutive
+//	sectors starting at newSector.  Once the head reaches the first
+//	sector, the rest stream past at one sector per RotationTime, plus
+//	a one-track seek each time the run crosses onto the next track
+//	(we assume the tracks are skewed so that no rotation is lost).
+//----------------------------------------------------------------------
+
+int Disk::ComputeLatency(int newSector, int numSectors, bool writing)
+{
+    int endSector = newSector + numSectors - 1;
+    int ticks = ComputeLatency(newSector, writing);
+
+    ticks += (numSectors - 1) * RotationTime;
+    ticks += (endSector / SectorsPerTrack - newSector / SectorsPerTrack) * SeekTime;
+    return ticks;
+}
+
 //----------------------------------------------------------------------
 // Disk::UpdateLast
 //   	Keep track of the most recently requested sector.  So we can know
@@ -261,3 +572,21 @@ void Disk::UpdateLast(int newSector)
     lastSector = newSector;
     DEBUG(dbgDisk, "Updating last sector = " << lastSector << " , " << bufferInit);
 }
+
+//----------------------------------------------------------------------
+// Disk::UpdateLast
+//   	Same, after a request for a run of sectors that took "ticks".
+//	If the run ended on a later track, the track buffer started
+//	loading when the head arrived there.
+//----------------------------------------------------------------------
+
+void Disk::UpdateLast(int newSector, int numSectors, int ticks)
+{
+    int endSector = newSector + numSectors - 1;
+
+    UpdateLast(newSector);
+    if (endSector / SectorsPerTrack != newSector / SectorsPerTrack)
+        bufferInit = kernel->stats->totalTicks + ticks -
+                     ((endSector % SectorsPerTrack) + 1) * RotationTime;
+    lastSector = endSector;
+}
@@ -20,6 +20,7 @@
 #include "copyright.h"
 #include "utility.h"
 #include "callback.h"
+#include <pthread.h>
 
 // The following class defines a physical disk I/O device.  The disk
 // has a single surface, split up into "tracks", and each track split
@@ -52,6 +53,23 @@ const int SectorsPerTrack  = 32;	// number of sectors per disk track
 const int NumTracks = 16500;		// number of tracks per disk
 const int NumSectors = (SectorsPerTrack * NumTracks);
 					// total # of sectors per disk
+const int MaxRequestSectors = SectorsPerTrack;
+					// most sectors one request can move
+
+// The order in which queued disk requests are sent to the disk by
+// SynchDisk.  Chosen with the "-ds" command line flag.
+
+enum DiskSchedPolicy {
+    DiskFIFO,		// in arrival order
+    DiskCSCAN,		// sweep toward higher sectors, then jump
+			// back to the lowest
+    DiskSPTF		// shortest positioning time (seek +
+			// rotation) first
+};
+
+// Where the worker thread doing a request's host I/O is at (with "-da").
+
+enum HostIOState { HostIdle, HostQueued, HostDone, HostQuit };
 
 class Disk : public CallBackObj {
   public:
@@ -67,6 +85,13 @@ class Disk : public CallBackObj {
     					// Only one request allowed at a time!
     void WriteRequest(int sectorNumber, char* data);
 
+    void ReadRequest(int sectorNumber, int numSectors, char** data);
+    					// Read/write "numSectors" consecutive
+					// sectors starting at sectorNumber,
+					// one buffer per sector, as a single
+					// request with a single interrupt.
+    void WriteRequest(int sectorNumber, int numSectors, char** data);
+
     void CallBack();			// Invoked when disk request 
 					// finishes. In turn calls, callWhenDone.
 
@@ -74,19 +99,53 @@ class Disk : public CallBackObj {
     					// Return how long a request to 
 					// newSector will take: 
 					// (seek + rotational delay + transfer)
+    int ComputeLatency(int newSector, int numSectors, bool writing);
+					// Same, for a run of sectors
+
+    int HeadSector() { return lastSector; }
+					// Where the head was left by the
+					// last request
+
+    void Sync();			// Make sure what was written is in
+					// the UNIX file (for a mapped disk)
+
+    void Erase();			// Set every sector to zeros, at once
+    void Copy(int sectorNumber, int numSectors, char** data, bool writing);
+					// Read/write sectors at once, with
+					// no simulated time and no interrupt
+					// (for formatting only)
 
   private:
     int fileno;				// UNIX file number for simulated disk 
     char diskname[32];			// name of simulated disk's file
+    char *image;			// the UNIX file mapped into memory,
+					// or NULL to read/write it instead
     CallBackObj *callWhenDone;		// Invoke when any disk request finishes
     bool active;     			// Is a disk operation in progress?
     int lastSector;			// The previous disk request 
     int bufferInit;			// When the track buffer started 
 					// being loaded
 
+    bool hostWorker;			// is a host thread doing the I/O?
+    pthread_t hostThread;		// that thread
+    pthread_mutex_t hostLock;		// guards what follows
+    pthread_cond_t hostReady;		// signalled when hostState changes
+    HostIOState hostState;
+    bool hostWriting;			// the request the worker is given
+    int hostSector;
+    int hostCount;
+    char *hostBuf;			// its data, contiguous
+    char *hostData[MaxRequestSectors];	// where a read's sectors go
+
+    void StartHostIO(bool writing, int sectorNumber, int numSectors);
+    void FinishHostIO();		// wait for the worker, scatter a read
+    friend void *DiskHostWorker(void *arg);
+
     int TimeToSeek(int newSector, int *rotate); // time to get to the new track
     int ModuloDiff(int to, int from);        // # sectors between to and from
+    int SeekDistance(int newSector, int numSectors); // # tracks crossed
     void UpdateLast(int newSector);
+    void UpdateLast(int newSector, int numSectors, int ticks);
 };
 
 #endif // DISK_H
@@ -23,6 +23,11 @@
 #include "copyright.h"
 #include "interrupt.h"
 #include "main.h"
+#include "synchdisk.h"
+#ifndef FILESYS_STUB
+#include "filehdr.h"
+#include "openfile.h"
+#endif
 
 // String definitions for debugging messages
 
@@ -253,6 +258,14 @@ void Interrupt::Halt()
     cout << "This is halt\n";
     kernel->stats->Print();
 	*/
+#ifndef FILESYS_STUB
+    kernel->fileSystem->Reclaim(); // files removed in the background
+    OpenFile::FlushAll();        // writes buffered by open files
+    kernel->inodeTable->Flush(); // changed headers of open files
+#endif
+    kernel->synchDisk->Flush(); // dirty cached sectors must reach the disk
+    if (debug->IsEnabled(dbgStats))
+        kernel->stats->Print();
     delete debug;
 
     delete kernel; // Never returns.
@@ -20,6 +20,13 @@ Statistics::Statistics()
 {
     totalTicks = idleTicks = systemTicks = userTicks = 0;
     numDiskReads = numDiskWrites = 0;
+    numDiskSectorsRead = numDiskSectorsWritten = 0;
+    numDiskSeekTracks = diskLatencyTicks = 0;
+    diskPolicyName = "FIFO";
+    numCacheHits = numCacheMisses = numCacheWriteBacks = 0;
+    numReadAheadSectors = numReadAheadHits = numReadAheadWasted = 0;
+    numNameCacheHits = numNameCacheMisses = 0;
+    numLogGroups = numLogSectors = numCheckpoints = 0;
     numConsoleCharsRead = numConsoleCharsWritten = 0;
     numPageFaults = numPacketsSent = numPacketsRecvd = 0;
 }
@@ -37,6 +44,24 @@ Statistics::Print()
 		cout << ", system " << systemTicks << ", user " << userTicks <<"\n";
     cout << "Disk I/O: reads " << numDiskReads;
 		cout << ", writes " << numDiskWrites << "\n";
+    cout << "Disk sectors: read " << numDiskSectorsRead;
+		cout << ", written " << numDiskSectorsWritten << "\n";
+    cout << "Disk scheduling (" << diskPolicyName << "): seek tracks ";
+		cout << numDiskSeekTracks << " (";
+		cout << numDiskSeekTracks / max(numDiskReads + numDiskWrites, 1);
+		cout << " per request), request latency " << diskLatencyTicks;
+		cout << " ticks\n";
+    cout << "Buffer cache: hits " << numCacheHits;
+		cout << ", misses " << numCacheMisses;
+		cout << ", write-backs " << numCacheWriteBacks << "\n";
+    cout << "Read-ahead: sectors " << numReadAheadSectors;
+		cout << ", hits " << numReadAheadHits;
+		cout << ", wasted " << numReadAheadWasted << "\n";
+    cout << "Name cache: hits " << numNameCacheHits;
+		cout << ", misses " << numNameCacheMisses << "\n";
+    cout << "Journal: groups " << numLogGroups;
+		cout << ", sectors logged " << numLogSectors;
+		cout << ", checkpoints " << numCheckpoints << "\n";
 		cout << "Console I/O: reads " << numConsoleCharsRead;
     cout << ", writes " << numConsoleCharsWritten << "\n";
     cout << "Paging: faults " << numPageFaults << "\n";
@@ -30,6 +30,22 @@ class Statistics {
 
     int numDiskReads;		// number of disk read requests
     int numDiskWrites;		// number of disk write requests
+    int numDiskSectorsRead;	// number of sectors moved by those requests
+    int numDiskSectorsWritten;
+    int numDiskSeekTracks;	// tracks the disk head moved across
+    int diskLatencyTicks;	// total time requests spent queued and served
+    const char *diskPolicyName;	// disk scheduling policy in use
+    int numCacheHits;		// disk sector requests found in the buffer cache
+    int numCacheMisses;		// disk sector requests not in the buffer cache
+    int numCacheWriteBacks;	// dirty cached sectors written back to disk
+    int numReadAheadSectors;	// sectors brought in before they were asked for
+    int numReadAheadHits;	// reads served by those sectors
+    int numReadAheadWasted;	// prefetched sectors evicted without being read
+    int numNameCacheHits;	// path components found in the name cache
+    int numNameCacheMisses;	// path components looked up in a directory
+    int numLogGroups;		// groups of metadata updates committed
+    int numLogSectors;		// sectors written to the log for them
+    int numCheckpoints;		// times the log was emptied
     int numConsoleCharsRead;	// number of characters read from the keyboard
     int numConsoleCharsWritten; // number of characters written to the display
     int numPageFaults;		// number of virtual memory page faults
@@ -0,0 +1,14 @@
+# Lookup cost in a large directory.  Fills /d with 3000 files, and
+# counts the sectors read (cache off) to print one file from it and one
+# from an almost empty directory; the difference should stay small.
+../build.linux/nachos -f
+../build.linux/nachos -mkdir /d
+../build.linux/nachos -mkdir /e
+for i in $(seq 1 3000); do
+    ../build.linux/nachos -cp num_100.txt /d/f$i
+done
+../build.linux/nachos -cp num_100.txt /e/f1
+echo "files in /d: $(../build.linux/nachos -l /d | wc -l)"
+for f in /e/f1 /d/f1 /d/f2999; do
+    echo "$f: $(../build.linux/nachos -bc 0 -p $f -d T | grep -oE "Disk sectors: read [0-9]+")"
+done
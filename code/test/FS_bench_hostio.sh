@@ -0,0 +1,18 @@
+# Wall-clock time of the same work with each host disk backend: read/
+# write on the UNIX file in line (default), in a host worker thread (-da),
+# and through a memory mapping (-dm).  The simulated statistics must be
+# the same for all three; only the real time should differ.
+for flag in "" -da -dm; do
+    ../build.linux/nachos -f
+    start=$(date +%s%N)
+    ../build.linux/nachos $flag -bc 0 -mkdir /d
+    for i in 1 2 3 4; do
+        ../build.linux/nachos $flag -bc 0 -cp num_50000.txt /d/f$i
+    done
+    for i in 1 2 3 4; do
+        ../build.linux/nachos $flag -bc 0 -p /d/f$i > /dev/null
+    done
+    ../build.linux/nachos $flag -bc 0 -p /d/f1 -d T | grep -oE "(Ticks|Disk I/O).*"
+    end=$(date +%s%N)
+    echo "${flag:-sync}: $(( (end - start) / 1000000 )) ms"
+done
@@ -0,0 +1,5 @@
+../build.linux/nachos -f
+../build.linux/nachos -cp num_1000.txt /1000
+../build.linux/nachos -cp num_50000.txt /50000
+../build.linux/nachos -p /1000 -d T | grep -oE "(Ticks|Disk I/O|Buffer cache|Read-ahead).*"
+../build.linux/nachos -p /50000 -d T | grep -oE "(Ticks|Disk I/O|Buffer cache|Read-ahead).*"
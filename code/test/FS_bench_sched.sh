@@ -0,0 +1,3 @@
+../build.linux/nachos -ds fifo -S
+../build.linux/nachos -ds cscan -S
+../build.linux/nachos -ds sptf -S
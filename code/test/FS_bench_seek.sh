@@ -0,0 +1,20 @@
+# Average seek distance with and without track-group placement.
+# The same files are created (directories interleaved with big files),
+# then read back; the seek statistics of the reads are added up.
+for flag in -ng ""; do
+    ../build.linux/nachos -f
+    ../build.linux/nachos $flag -mkdir /a
+    ../build.linux/nachos $flag -mkdir /b
+    ../build.linux/nachos $flag -cp num_50000.txt /a/big1
+    ../build.linux/nachos $flag -cp num_1000.txt /b/s1
+    ../build.linux/nachos $flag -cp num_50000.txt /a/big2
+    ../build.linux/nachos $flag -cp num_1000.txt /b/s2
+    ../build.linux/nachos $flag -cp num_100.txt /b/s3
+    for f in /b/s1 /b/s2 /b/s3 /a/big2; do
+        ../build.linux/nachos -p $f -d T | grep -oE "(Disk I/O|Disk scheduling).*"
+    done | awk -v name="${flag:-groups}" '
+        /Disk I\/O/ { sub(",", "", $4); requests += $4 + $6 }
+        /seek tracks/ { tracks += $6 }
+        END { printf "%s: %d requests, seek tracks %d, average %.1f\n",
+                     name, requests, tracks, tracks / requests }'
+done
@@ -0,0 +1,10 @@
+../build.linux/nachos -f
+head -c 100 num_100.txt > inline.txt
+../build.linux/nachos -cp inline.txt /small
+../build.linux/nachos -cpout /small small.out
+cmp small.out inline.txt && echo "100-byte file kept in its header is intact"
+echo "========================================="
+../build.linux/nachos -ap num_100.txt /small
+../build.linux/nachos -cpout /small small.out
+cat inline.txt num_100.txt | cmp - small.out && echo "file moved out of its header is intact"
+rm -f inline.txt small.out
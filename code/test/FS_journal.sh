@@ -0,0 +1,4 @@
+../build.linux/nachos -f
+../build.linux/nachos -cp num_1000.txt /f1
+../build.linux/nachos -J
+../build.linux/nachos -p /f1 | tail -1
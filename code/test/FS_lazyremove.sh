@@ -0,0 +1,13 @@
+../build.linux/nachos -f
+before=$(../build.linux/nachos -D | grep "Free sectors:" | awk '{print $3}')
+../build.linux/nachos -mkdir /d
+../build.linux/nachos -cp num_10000.txt /d/f1
+../build.linux/nachos -cp num_50000.txt /d/f2
+../build.linux/nachos -cp num_1000.txt /f3
+../build.linux/nachos -rb -rr /d
+../build.linux/nachos -rb -r /f3
+../build.linux/nachos -l /
+echo "========================================="
+after=$(../build.linux/nachos -D | grep "Free sectors:" | awk '{print $3}')
+echo "free sectors before: $before, after removing: $after"
+[ "$before" -eq "$after" ] && echo "all space given back" || exit 1
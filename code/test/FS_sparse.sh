@@ -0,0 +1,12 @@
+../build.linux/nachos -f
+../build.linux/nachos -cp num_100.txt /full
+../build.linux/nachos -cr /sparse 5000
+../build.linux/nachos -ap num_100.txt /sparse
+../build.linux/nachos -l /
+echo "========================================="
+../build.linux/nachos -cpout /sparse sparse.out
+echo "non-zero bytes in the hole: $(head -c 5000 sparse.out | tr -d '\000' | wc -c)"
+tail -c +5001 sparse.out | cmp - num_100.txt && echo "data written past the hole is intact"
+../build.linux/nachos -cpout /full full.out
+cmp full.out num_100.txt && echo "copied file is intact"
+rm -f sparse.out full.out
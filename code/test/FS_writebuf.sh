@@ -0,0 +1,7 @@
+../build.linux/nachos -f
+../build.linux/nachos -cp FS_test1 /FS_test1
+../build.linux/nachos -e /FS_test1
+echo "========================================="
+../build.linux/nachos -cpout /file1 file1.out
+echo "abcdefghijklmnopqrstuvwxyz" | cmp - file1.out && echo "27 one-byte writes read back intact"
+rm -f file1.out
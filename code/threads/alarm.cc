@@ -11,6 +11,7 @@
 #include "copyright.h"
 #include "alarm.h"
 #include "main.h"
+#include "synchdisk.h"
 
 //----------------------------------------------------------------------
 // Alarm::Alarm
@@ -52,4 +53,7 @@ Alarm::CallBack()
     if (status != IdleMode) {
 	interrupt->YieldOnReturn();
     }
+    if (kernel->synchDisk != NULL) {
+	kernel->synchDisk->WakeFlusher();	// dirty buffers may be old now
+    }
 }
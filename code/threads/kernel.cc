@@ -15,6 +15,9 @@
 #include "libtest.h"
 #include "string.h"
 #include "synchdisk.h"
+#ifndef FILESYS_STUB
+#include "filehdr.h"
+#endif
 #include "post.h"
 #include "synchconsole.h"
 
@@ -33,6 +36,14 @@ Kernel::Kernel(int argc, char **argv)
 #ifndef FILESYS_STUB
     formatFlag = FALSE;
 #endif
+    cacheSize = DefaultCacheSize; // sectors in the disk buffer cache
+    diskPolicy = DiskCSCAN;
+    readAheadMin = 4;           // read-ahead window, in sectors
+    readAheadMax = 32;
+    trackGroups = TRUE;         // keep files near their directory
+    mapDisk = FALSE;            // read/write the disk's UNIX file
+    asyncDisk = FALSE;          // ... in line with the request
+    lazyRemove = FALSE;         // Remove frees the space itself
     reliability = 1;            // network reliability, default is 1.0
     hostName = 0;               // machine id, also UNIX socket name
                                 // 0 is the default machine id
@@ -64,6 +75,37 @@ Kernel::Kernel(int argc, char **argv)
 		} else if (strcmp(argv[i], "-f") == 0) {
 	    	formatFlag = TRUE;
 #endif
+		} else if (strcmp(argv[i], "-bc") == 0) {
+	    	ASSERT(i + 1 < argc);   // next argument is int
+	    	cacheSize = atoi(argv[i + 1]);
+	    	// 0 turns it off; otherwise the journal needs room to pin
+	    	ASSERT(cacheSize == 0 || cacheSize >= MinCacheSize);
+	    	i++;
+		} else if (strcmp(argv[i], "-ds") == 0) {
+	    	ASSERT(i + 1 < argc);   // next argument is the policy name
+	    	if (strcmp(argv[i + 1], "fifo") == 0)
+	    	    diskPolicy = DiskFIFO;
+	    	else if (strcmp(argv[i + 1], "cscan") == 0)
+	    	    diskPolicy = DiskCSCAN;
+	    	else if (strcmp(argv[i + 1], "sptf") == 0)
+	    	    diskPolicy = DiskSPTF;
+	    	else
+	    	    ASSERTNOTREACHED();
+	    	i++;
+		} else if (strcmp(argv[i], "-ra") == 0) {
+	    	ASSERT(i + 2 < argc);   // next arguments are ints
+	    	readAheadMin = atoi(argv[i + 1]);
+	    	readAheadMax = atoi(argv[i + 2]);
+	    	ASSERT(0 <= readAheadMin && readAheadMin <= readAheadMax);
+	    	i += 2;
+		} else if (strcmp(argv[i], "-ng") == 0) {
+	    	trackGroups = FALSE;
+		} else if (strcmp(argv[i], "-dm") == 0) {
+	    	mapDisk = TRUE;
+		} else if (strcmp(argv[i], "-da") == 0) {
+	    	asyncDisk = TRUE;
+		} else if (strcmp(argv[i], "-rb") == 0) {
+	    	lazyRemove = TRUE;
         } else if (strcmp(argv[i], "-n") == 0) {
             ASSERT(i + 1 < argc);   // next argument is float
             reliability = atof(argv[i + 1]);
@@ -79,6 +121,12 @@ Kernel::Kernel(int argc, char **argv)
 #ifndef FILESYS_STUB
 	    	cout << "Partial usage: nachos [-nf]\n";
 #endif
+	    	cout << "Partial usage: nachos [-bc cacheSectors]\n";
+	    	cout << "Partial usage: nachos [-ds fifo|cscan|sptf]\n";
+	    	cout << "Partial usage: nachos [-ra minSectors maxSectors]\n";
+	    	cout << "Partial usage: nachos [-ng]\n";
+	    	cout << "Partial usage: nachos [-dm] [-da]\n";
+	    	cout << "Partial usage: nachos [-rb]\n";
             cout << "Partial usage: nachos [-n #] [-m #]\n";
 		}
     }
@@ -109,12 +157,16 @@ Kernel::Initialize()
     machine = new Machine(debugUserProg);
     synchConsoleIn = new SynchConsoleInput(consoleIn); // input from stdin
     synchConsoleOut = new SynchConsoleOutput(consoleOut); // output to stdout
-    synchDisk = new SynchDisk();    //
+    synchDisk = new SynchDisk(cacheSize, diskPolicy);    //
 #ifdef FILESYS_STUB
     fileSystem = new FileSystem();
 #else
+    inodeTable = new InodeTable(NumInodes);
     fileSystem = new FileSystem(formatFlag);
+    if (lazyRemove)
+        fileSystem->StartReclaimer(); // free removed files in the background
 #endif // FILESYS_STUB
+    synchDisk->StartFlusher();	// write dirty buffers in the background
 
 	// MP4 mod tag
     /*
@@ -153,8 +205,11 @@ Kernel::~Kernel()
     delete machine;
     delete synchConsoleIn;
     delete synchConsoleOut;
-    delete synchDisk;
     delete fileSystem;
+#ifndef FILESYS_STUB
+    delete inodeTable;
+#endif
+    delete synchDisk;
 	
 	// Mp4 mod tag
 	/*
@@ -18,12 +18,14 @@
 #include "alarm.h"
 #include "filesys.h"
 #include "machine.h"
+#include "disk.h"
 
 class PostOfficeInput;
 class PostOfficeOutput;
 class SynchConsoleInput;
 class SynchConsoleOutput;
 class SynchDisk;
+class InodeTable;
 
 
 
@@ -65,10 +67,19 @@ class Kernel {
     SynchConsoleOutput *synchConsoleOut;
     SynchDisk *synchDisk;
     FileSystem *fileSystem;     
+#ifndef FILESYS_STUB
+    InodeTable *inodeTable;     // headers of files in use
+#endif
     PostOfficeInput *postOfficeIn;
     PostOfficeOutput *postOfficeOut;
 
     int hostName;               // machine identifier
+    int readAheadMin;           // smallest and largest read-ahead
+    int readAheadMax;           // window, in sectors
+    bool trackGroups;           // place files by track group?
+    bool mapDisk;               // map the disk's UNIX file into memory?
+    bool asyncDisk;             // do the disk's UNIX I/O in a host thread?
+    bool lazyRemove;            // free removed files in the background?
 
   private:
 
@@ -84,6 +95,8 @@ class Kernel {
 #ifndef FILESYS_STUB
     bool formatFlag;          // format the disk if this is true
 #endif
+    int cacheSize;              // sectors in the disk buffer cache
+    DiskSchedPolicy diskPolicy; // order to serve disk requests in
 };
 
 
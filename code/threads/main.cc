@@ -4,7 +4,9 @@
 //
 // Usage: nachos -d <debugflags> -rs <random seed #>
 //              -s -x <nachos file> -ci <consoleIn> -co <consoleOut>
-//              -f -cp <unix file> <nachos file>
+//              -f -cp <unix file> <nachos file> -cpr <unix dir> <nachos dir>
+//              -cpout <nachos file> <unix file>
+//              -ap <unix file> <nachos file> -cr <nachos file> <size>
 //              -p <nachos file> -r <nachos file> -l -D
 //              -n <network reliability> -m <machine id>
 //              -z -K -C -N
@@ -25,10 +27,18 @@
 //    Filesystem-related flags:
 //    -f forces the Nachos disk to be formatted
 //    -cp copies a file from UNIX to Nachos
+//    -cpr copies a whole UNIX directory tree to Nachos
+//    -cpout copies a Nachos file, or directory tree, to UNIX
+//    -ap appends a file from UNIX to a Nachos file, creating it if needed
+//    -cr creates a Nachos file of the given size, which reads as zeros
 //    -p prints a Nachos file to stdout
 //    -r removes a Nachos file from the file system
 //    -l lists the contents of the Nachos directory
 //    -D prints the contents of the entire file system 
+//    -J commits groups until the journal wraps around, then crashes
+//       and checks that Recover replays the last one; then frees a
+//       logged sector, reuses it for data, crashes, and checks that
+//       Recover leaves the data alone
 //
 //  Note: the file system flags are not used if the stub filesystem
 //        is being used
@@ -43,8 +53,11 @@
 
 #include "main.h"
 #include "filesys.h"
+#include "synchdisk.h"
 #include "openfile.h"
+#include "directory.h"
 #include "sysdep.h"
+#include <pthread.h>
 
 // global variables
 Kernel *kernel;
@@ -64,14 +77,135 @@ Cleanup(int x)
 }
 
 //-------------------------------------------------------------------
-// Constant used by "Copy" and "Print"
-//   It is the number of bytes read from the Unix file (for Copy)
-//   or the Nachos file (for Print) by each read operation
+// Constant used by "Append"
+//   It is the number of bytes read from the Unix file by each read
+//   operation
 //-------------------------------------------------------------------
 static const int TransferSize = 128;
 
+// Copy, Print and Export move files in much bigger pieces, so that each
+// Read or Write covers many sectors.  A file Copy imports that is longer
+// than that is read from UNIX by a host thread, one piece ahead of the
+// piece being written.
+static const int BulkSize = 64 * 1024;
+
+// Longest UNIX path -cpr and -cpout build
+static const int MaxHostPath = 1024;
+
 
 #ifndef FILESYS_STUB
+//----------------------------------------------------------------------
+// ImportPipe
+//      Two buffers between the host thread reading a UNIX file and the
+//      Nachos thread writing it to a Nachos file.  length[k] is -1 while
+//      buffer k waits to be filled, then the bytes it holds (0 at the
+//      end of the file).
+//----------------------------------------------------------------------
+
+struct ImportPipe {
+    int fd;
+    char *data[2];
+    int length[2];
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+//----------------------------------------------------------------------
+// ReadAhead
+//      Body of the host thread: fill the buffers in turn, each once the
+//      writer has emptied it, until the end of the UNIX file.
+//----------------------------------------------------------------------
+
+static void *
+ReadAhead(void *arg)
+{
+    ImportPipe *pipe = (ImportPipe *)arg;
+    int k = 0, amountRead;
+
+    do {
+        pthread_mutex_lock(&pipe->lock);
+        while (pipe->length[k] != -1)
+            pthread_cond_wait(&pipe->changed, &pipe->lock);
+        pthread_mutex_unlock(&pipe->lock);
+
+        amountRead = max(ReadPartial(pipe->fd, pipe->data[k], BulkSize), 0);
+
+        pthread_mutex_lock(&pipe->lock);
+        pipe->length[k] = amountRead;
+        pthread_cond_signal(&pipe->changed);
+        pthread_mutex_unlock(&pipe->lock);
+        k = 1 - k;
+    } while (amountRead > 0);
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// Import
+//      Write the rest of the UNIX file "fd", "fileLength" bytes long,
+//      to "openFile", BulkSize bytes at a time.  If there is more
+//      than one piece, the next is read by ReadAhead while this one is
+//      written (double buffering).
+//
+//      Return FALSE if a piece did not all fit (the disk is full); the
+//      rest is not written then, but the reader still runs to the end
+//      of the UNIX file, so that it can be joined.
+//----------------------------------------------------------------------
+
+static bool
+Import(int fd, int fileLength, OpenFile *openFile)
+{
+    ImportPipe pipe;
+    pthread_t reader;
+    int k, amountRead;
+    bool written = TRUE;
+
+    pipe.data[0] = new char[BulkSize];
+    if (fileLength <= BulkSize)
+    { // 一次就讀完，不用 thread
+        if ((amountRead = ReadPartial(fd, pipe.data[0], BulkSize)) > 0)
+            written = (openFile->Write(pipe.data[0], amountRead) == amountRead);
+        delete[] pipe.data[0];
+        return written;
+    }
+    pipe.data[1] = new char[BulkSize];
+    pipe.fd = fd;
+    pipe.length[0] = pipe.length[1] = -1;
+    pthread_mutex_init(&pipe.lock, NULL);
+    pthread_cond_init(&pipe.changed, NULL);
+    if (pthread_create(&reader, NULL, ReadAhead, &pipe) != 0)
+    { // no thread: read and write by turns
+        while (written && (amountRead = ReadPartial(fd, pipe.data[0], BulkSize)) > 0)
+            written = (openFile->Write(pipe.data[0], amountRead) == amountRead);
+    }
+    else
+    {
+        for (k = 0;; k = 1 - k)
+        {
+            pthread_mutex_lock(&pipe.lock);
+            while (pipe.length[k] == -1)
+                pthread_cond_wait(&pipe.changed, &pipe.lock);
+            amountRead = pipe.length[k];
+            pthread_mutex_unlock(&pipe.lock);
+            if (amountRead == 0)
+                break;
+
+            if (written) // 寫不下之後只把剩下的讀完
+                written = (openFile->Write(pipe.data[k], amountRead) == amountRead);
+
+            pthread_mutex_lock(&pipe.lock);
+            pipe.length[k] = -1;
+            pthread_cond_signal(&pipe.changed);
+            pthread_mutex_unlock(&pipe.lock);
+        }
+        pthread_join(reader, NULL);
+    }
+    pthread_mutex_destroy(&pipe.lock);
+    pthread_cond_destroy(&pipe.changed);
+    delete[] pipe.data[0];
+    delete[] pipe.data[1];
+    return written;
+}
+
 //----------------------------------------------------------------------
 // Copy
 //      Copy the contents of the UNIX file "from" to the Nachos file "to"
@@ -82,9 +216,7 @@ Copy(char *from, char *to)
 {
     int fd;
     OpenFile* openFile;
-    int amountRead, fileLength;
-    char *buffer;
-    char *temp = new char [100];
+    int fileLength;
 
 // Open UNIX file
     if ((fd = OpenForReadWrite(from,FALSE)) < 0) {       
@@ -99,20 +231,143 @@ Copy(char *from, char *to)
 
 // Create a Nachos file of the same length
     DEBUG('f', "Copying file " << from << " of size " << fileLength <<  " to file " << to);
-    strcpy(temp, to); // 如果不複製的話，to會在fileSystem->Create()中被修改，之後就沒辦法用正確的路徑來open file
     if (!kernel->fileSystem->Create(to, fileLength)) {   // Create Nachos file
         printf("Copy: couldn't create output file %s\n", to);
         Close(fd);
         return;
     }
-    strcpy(to, temp);
     openFile = kernel->fileSystem->Open(to);
     ASSERT(openFile != NULL);
+    openFile->Preallocate(fileLength); // one run, not one per chunk
     
-// Copy the data in TransferSize chunks
+// Copy the data in BulkSize chunks
+    if (!Import(fd, fileLength, openFile))
+        printf("Copy: couldn't write all of output file %s\n", to);
+
+// Close the UNIX and the Nachos files
+    delete openFile;
+    Close(fd);
+}
+
+//----------------------------------------------------------------------
+// CompareNames
+//      Order names for qsort.
+//----------------------------------------------------------------------
+
+static int
+CompareNames(const void *a, const void *b)
+{
+    return strcmp(*(char **)a, *(char **)b);
+}
+
+//----------------------------------------------------------------------
+// CopyTree
+//      Copy the UNIX file or directory tree "from" to "to" in Nachos.
+//      Directories are created as needed (an existing one is copied
+//      into); the names in each are taken in sorted order, so the same
+//      tree is always laid out the same way.  Names longer than Nachos
+//      allows are cut, as everywhere else.
+//----------------------------------------------------------------------
+
+static void
+CopyTree(char *from, char *to)
+{
+    char fromPath[MaxHostPath], toPath[MaxHostPath];
+    char **names;
+    char *name;
+    void *dir;
+    OpenFile *existing;
+    int numNames, maxNames, i;
+
+    if (!IsDirectory(from))
+    {
+        Copy(from, to);
+        return;
+    }
+    if ((dir = OpenDir(from)) == NULL)
+    {
+        printf("Copy: couldn't open input directory %s\n", from);
+        return;
+    }
+    if ((existing = kernel->fileSystem->Open(to)) != NULL)
+        delete existing;
+    else
+        kernel->fileSystem->CreateDirectory(to);
+
+    numNames = 0;
+    maxNames = 16;
+    names = new char *[maxNames];
+    while ((name = NextDirEntry(dir)) != NULL)
+    {
+        if (numNames == maxNames)
+        {
+            char **more = new char *[2 * maxNames];
+            bcopy(names, more, maxNames * sizeof(char *));
+            delete[] names;
+            names = more;
+            maxNames *= 2;
+        }
+        names[numNames] = new char[strlen(name) + 1];
+        strcpy(names[numNames++], name);
+    }
+    CloseDir(dir);
+    qsort(names, numNames, sizeof(char *), CompareNames);
+
+    for (i = 0; i < numNames; i++)
+    {
+        if (strlen(from) + strlen(names[i]) + 2 > (unsigned)MaxHostPath ||
+            strlen(to) + strlen(names[i]) + 2 > (unsigned)MaxHostPath)
+            printf("Copy: path too long for %s\n", names[i]);
+        else
+        {
+            sprintf(fromPath, "%s/%s", from, names[i]);
+            sprintf(toPath, "%s%s%s", to, (to[strlen(to) - 1] == '/') ? "" : "/", names[i]);
+            CopyTree(fromPath, toPath);
+        }
+        delete[] names[i];
+    }
+    delete[] names;
+}
+
+//----------------------------------------------------------------------
+// Append
+//      Append the contents of the UNIX file "from" to the Nachos file
+//      "to", creating it empty first if it does not exist.  The Nachos
+//      file grows with each write.
+//----------------------------------------------------------------------
+
+static void
+Append(char *from, char *to)
+{
+    int fd;
+    OpenFile* openFile;
+    int amountRead;
+    char *buffer;
+
+// Open UNIX file
+    if ((fd = OpenForReadWrite(from,FALSE)) < 0) {
+        printf("Append: couldn't open input file %s\n", from);
+        return;
+    }
+
+// Open the Nachos file, or create an empty one
+    openFile = kernel->fileSystem->Open(to);
+    if (openFile == NULL) {
+        if (!kernel->fileSystem->Create(to, 0)) {
+            printf("Append: couldn't create output file %s\n", to);
+            Close(fd);
+            return;
+        }
+        openFile = kernel->fileSystem->Open(to);
+        ASSERT(openFile != NULL);
+    }
+    DEBUG('f', "Appending file " << from << " to file " << to << " of size " << openFile->Length());
+    openFile->Seek(openFile->Length());
+
+// Append the data in TransferSize chunks
     buffer = new char[TransferSize];
     while ((amountRead=ReadPartial(fd, buffer, sizeof(char)*TransferSize)) > 0)
-        openFile->Write(buffer, amountRead);    
+        openFile->Write(buffer, amountRead);
     delete [] buffer;
 
 // Close the UNIX and the Nachos files
@@ -120,6 +375,75 @@ Copy(char *from, char *to)
     Close(fd);
 }
 
+//----------------------------------------------------------------------
+// Export
+//      Copy the contents of the Nachos file "from" to the UNIX file
+//      "to", replacing whatever "to" held, BulkSize bytes at a time.
+//----------------------------------------------------------------------
+
+static void
+Export(char *from, char *to)
+{
+    OpenFile *openFile;
+    int fd, amountRead;
+    char *buffer;
+
+    if ((openFile = kernel->fileSystem->Open(from)) == NULL)
+    {
+        printf("Export: unable to open file %s\n", from);
+        return;
+    }
+    fd = OpenForWrite(to);
+
+    buffer = new char[BulkSize];
+    while ((amountRead = openFile->Read(buffer, BulkSize)) > 0)
+        WriteFile(fd, buffer, amountRead);
+    delete[] buffer;
+
+    Close(fd);
+    delete openFile;
+}
+
+//----------------------------------------------------------------------
+// ExportTree
+//      Copy the Nachos file or directory tree "from" to "to" in UNIX.
+//      Directories are made as needed (an existing one is copied into).
+//----------------------------------------------------------------------
+
+static void
+ExportTree(char *from, char *to)
+{
+    char fromPath[MaxHostPath], toPath[MaxHostPath];
+    DirectoryEntry *entries;
+    int numEntries, i;
+
+    if ((entries = kernel->fileSystem->ReadDirectory(from, &numEntries)) == NULL)
+    {
+        Export(from, to);
+        return;
+    }
+    if (!IsDirectory(to) && !MakeDirectory(to))
+    {
+        printf("Export: couldn't make directory %s\n", to);
+        delete[] entries;
+        return;
+    }
+    for (i = 0; i < numEntries; i++)
+    {
+        if (strlen(from) + strlen(entries[i].name) + 2 > (unsigned)MaxHostPath ||
+            strlen(to) + strlen(entries[i].name) + 2 > (unsigned)MaxHostPath)
+        {
+            printf("Export: path too long for %s\n", entries[i].name);
+            continue;
+        }
+        sprintf(fromPath, "%s%s%s", from, (from[strlen(from) - 1] == '/') ? "" : "/",
+                entries[i].name);
+        sprintf(toPath, "%s/%s", to, entries[i].name);
+        ExportTree(fromPath, toPath);
+    }
+    delete[] entries;
+}
+
 #endif // FILESYS_STUB
 
 //----------------------------------------------------------------------
@@ -130,7 +454,7 @@ Copy(char *from, char *to)
 void Print(char *name)
 {
     OpenFile *openFile;
-    int i, amountRead;
+    int amountRead;
     char *buffer;
 
     if ((openFile = kernel->fileSystem->Open(name)) == NULL)
@@ -139,10 +463,9 @@ void Print(char *name)
         return;
     }
 
-    buffer = new char[TransferSize];
-    while ((amountRead = openFile->Read(buffer, TransferSize)) > 0)
-        for (i = 0; i < amountRead; i++)
-            printf("%c", buffer[i]);
+    buffer = new char[BulkSize];
+    while ((amountRead = openFile->Read(buffer, BulkSize)) > 0)
+        fwrite(buffer, 1, amountRead, stdout);
     delete[] buffer;
 
     delete openFile; // close the Nachos file
@@ -182,13 +505,22 @@ int main(int argc, char **argv)
     bool threadTestFlag = false;
     bool consoleTestFlag = false;
     bool networkTestFlag = false;
+    bool diskTestFlag = false;
 #ifndef FILESYS_STUB
     char *copyUnixFileName = NULL;   // UNIX file to be copied into Nachos
     char *copyNachosFileName = NULL; // name of copied file in Nachos
+    bool copyTreeFlag = false;       // ... and whatever is under it
+    char *appendUnixFileName = NULL;   // UNIX file to be appended
+    char *appendNachosFileName = NULL; // Nachos file it is appended to
+    char *createFileName = NULL;       // empty Nachos file to create
+    int createFileSize = 0;            // ... and its size
     char *printFileName = NULL;
+    char *exportNachosName = NULL;     // Nachos file or tree to export
+    char *exportUnixName = NULL;       // ... and where it goes in UNIX
     char *removeFileName = NULL;
     bool dirListFlag = false;
     bool dumpFlag = false;
+    bool journalTestFlag = false;
     // MP4 mod tag
     char *createDirectoryName = NULL;
     char *listDirectoryName = NULL;
@@ -230,6 +562,10 @@ int main(int argc, char **argv)
         {
             networkTestFlag = TRUE;
         }
+        else if (strcmp(argv[i], "-S") == 0)
+        {
+            diskTestFlag = TRUE;
+        }
 #ifndef FILESYS_STUB
         else if (strcmp(argv[i], "-cp") == 0)
         {
@@ -238,6 +574,36 @@ int main(int argc, char **argv)
             copyNachosFileName = argv[i + 2];
             i += 2;
         }
+        else if (strcmp(argv[i], "-cpr") == 0)
+        {
+            ASSERT(i + 2 < argc);
+            copyUnixFileName = argv[i + 1];
+            copyNachosFileName = argv[i + 2];
+            copyTreeFlag = true;
+            i += 2;
+        }
+        else if (strcmp(argv[i], "-ap") == 0)
+        {
+            ASSERT(i + 2 < argc);
+            appendUnixFileName = argv[i + 1];
+            appendNachosFileName = argv[i + 2];
+            i += 2;
+        }
+        else if (strcmp(argv[i], "-cr") == 0)
+        {
+            ASSERT(i + 2 < argc);
+            createFileName = argv[i + 1];
+            createFileSize = atoi(argv[i + 2]);
+            ASSERT(createFileSize >= 0);
+            i += 2;
+        }
+        else if (strcmp(argv[i], "-cpout") == 0)
+        {
+            ASSERT(i + 2 < argc);
+            exportNachosName = argv[i + 1];
+            exportUnixName = argv[i + 2];
+            i += 2;
+        }
         else if (strcmp(argv[i], "-p") == 0)
         {
             ASSERT(i + 1 < argc);
@@ -288,16 +654,24 @@ int main(int argc, char **argv)
         {
             dumpFlag = true;
         }
+        else if (strcmp(argv[i], "-J") == 0)
+        {
+            journalTestFlag = true;
+        }
 #endif //FILESYS_STUB
         else if (strcmp(argv[i], "-u") == 0)
         {
             cout << "Partial usage: nachos [-z -d debugFlags]\n";
             cout << "Partial usage: nachos [-x programName]\n";
-            cout << "Partial usage: nachos [-K] [-C] [-N]\n";
+            cout << "Partial usage: nachos [-K] [-C] [-N] [-S]\n";
 #ifndef FILESYS_STUB
             cout << "Partial usage: nachos [-cp UnixFile NachosFile]\n";
+            cout << "Partial usage: nachos [-cpr UnixDir NachosDir]\n";
+            cout << "Partial usage: nachos [-cpout NachosFile UnixFile]\n";
+            cout << "Partial usage: nachos [-ap UnixFile NachosFile]\n";
+            cout << "Partial usage: nachos [-cr NachosFile size]\n";
             cout << "Partial usage: nachos [-p fileName] [-r fileName]\n";
-            cout << "Partial usage: nachos [-l] [-D]\n";
+            cout << "Partial usage: nachos [-l] [-D] [-J]\n";
 #endif //FILESYS_STUB
         }
     }
@@ -325,6 +699,10 @@ int main(int argc, char **argv)
     {
         kernel->NetworkTest(); // two-machine test of the network
     }
+    if (diskTestFlag)
+    {
+        kernel->synchDisk->SelfTest(); // concurrent disk requests
+    }
 
 #ifndef FILESYS_STUB
     if (removeFileName != NULL && recursiveRemoveFlag) {
@@ -334,14 +712,31 @@ int main(int argc, char **argv)
     {
         kernel->fileSystem->Remove(removeFileName, false);
     }
-    if (copyUnixFileName != NULL && copyNachosFileName != NULL)
+    if (copyUnixFileName != NULL && copyNachosFileName != NULL && copyTreeFlag)
+    {
+        CopyTree(copyUnixFileName, copyNachosFileName);
+    }
+    else if (copyUnixFileName != NULL && copyNachosFileName != NULL)
     {
         Copy(copyUnixFileName, copyNachosFileName);
     }
+    if (appendUnixFileName != NULL && appendNachosFileName != NULL)
+    {
+        Append(appendUnixFileName, appendNachosFileName);
+    }
+    if (createFileName != NULL &&
+        !kernel->fileSystem->Create(createFileName, createFileSize))
+    {
+        printf("Create: couldn't create %s\n", createFileName);
+    }
     if (dumpFlag)
     {
         kernel->fileSystem->Print();
     }
+    if (journalTestFlag)
+    {
+        kernel->synchDisk->JournalTest(); // crash recovery
+    }
     if (dirListFlag && recursiveListFlag)
     {
         // recursively list
@@ -361,6 +756,10 @@ int main(int argc, char **argv)
     {
         Print(printFileName);
     }
+    if (exportNachosName != NULL && exportUnixName != NULL)
+    {
+        ExportTree(exportNachosName, exportUnixName);
+    }
 #endif // FILESYS_STUB
 
     // finally, run an initial user program if requested to do so
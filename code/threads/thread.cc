@@ -46,6 +46,7 @@ Thread::Thread(char* threadName, int threadID)
 					// of machine registers
     }
     space = NULL;
+    updateDepth = 0;
 }
 
 //----------------------------------------------------------------------
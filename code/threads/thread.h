@@ -131,6 +131,10 @@ class Thread {
     void RestoreUserState();		// restore user-level register state
 
     AddrSpace *space;			// User code this thread is running.
+
+    int updateDepth;			// File system updates it is in (cf.
+					// SynchDisk::BeginUpdate); only
+					// their writes are journaled
 };
 
 // external function, dummy routine whose sole job is to call Thread::Print
@@ -79,15 +79,21 @@ AddrSpace::AddrSpace()
     
     // zero out the entire address space
     bzero(kernel->machine->mainMemory, MemorySize);
+
+    for (int i = 0; i < MaxOpenFiles; i++)
+	openFiles[i] = NULL;
 }
 
 //----------------------------------------------------------------------
 // AddrSpace::~AddrSpace
-// 	Dealloate an address space.
+// 	Dealloate an address space, closing the files the program
+//	left open.
 //----------------------------------------------------------------------
 
 AddrSpace::~AddrSpace()
 {
+   for (int i = FirstFileId; i < MaxOpenFiles; i++)
+	delete openFiles[i];
    delete pageTable;
 }
 
@@ -312,5 +318,54 @@ AddrSpace::Translate(unsigned int vaddr, unsigned int *paddr, int isReadWrite)
 }
 
 
+//----------------------------------------------------------------------
+// AddrSpace::AddFile
+// 	Put an open file in the program's open file table, and return
+//	the OpenFileId the program will use for it.  Return -1 if the
+//	program already has MaxOpenFiles open.
+//
+//	"file" -- the open file; the table now owns it
+//----------------------------------------------------------------------
+
+OpenFileId
+AddrSpace::AddFile(OpenFile *file)
+{
+    for (int i = FirstFileId; i < MaxOpenFiles; i++)
+	if (openFiles[i] == NULL) {
+	    openFiles[i] = file;
+	    return i;
+	}
+    return -1;
+}
 
+//----------------------------------------------------------------------
+// AddrSpace::GetFile
+// 	Return the open file with OpenFileId "id", or NULL if the program
+//	has no such file open.
+//----------------------------------------------------------------------
 
+OpenFile *
+AddrSpace::GetFile(OpenFileId id)
+{
+    if (id < FirstFileId || id >= MaxOpenFiles)
+	return NULL;
+    return openFiles[id];
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::CloseFile
+// 	Close the open file with OpenFileId "id", and free its slot.
+//	Return FALSE if there is no such file.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::CloseFile(OpenFileId id)
+{
+    OpenFile *file = GetFile(id);
+
+    if (file == NULL)
+	return FALSE;
+    delete file;
+    openFiles[id] = NULL;
+    return TRUE;
+}
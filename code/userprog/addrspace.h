@@ -17,6 +17,8 @@
 #include "filesys.h"
 
 #define UserStackSize		1024 	// increase this as necessary!
+#define MaxOpenFiles		20	// size of the open file table
+#define FirstFileId		2	// 0 and 1 are the console
 
 class AddrSpace {
   public:
@@ -39,6 +41,12 @@ class AddrSpace {
     // is 0 for Read, 1 for Write.
     ExceptionType Translate(unsigned int vaddr, unsigned int *paddr, int mode);
 
+    OpenFileId AddFile(OpenFile *file);	// Give an open file an id;
+					// -1 if the table is full
+    OpenFile *GetFile(OpenFileId id);	// Open file with this id, or
+					// NULL if there is none
+    bool CloseFile(OpenFileId id);	// Close the file with this id
+
   private:
     TranslationEntry *pageTable;	// Assume linear page table translation
 					// for now!
@@ -48,6 +56,9 @@ class AddrSpace {
     void InitRegisters();		// Initialize user-level CPU registers,
 					// before jumping to user code
 
+    OpenFile *openFiles[MaxOpenFiles];	// Files this program has open,
+					// indexed by OpenFileId
+
 };
 
 #endif // ADDRSPACE_H
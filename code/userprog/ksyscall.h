@@ -14,6 +14,10 @@
 #include "kernel.h"
 
 #include "synchconsole.h"
+#include "synchdisk.h"
+#ifndef FILESYS_STUB
+#include "filehdr.h"
+#endif
 
 void SysHalt()
 {
@@ -43,32 +47,78 @@ int SysCreate(char *filename, int size)
 }
 OpenFileId SysOpen(char *name)
 {
-	if (kernel->fileSystem->Open(name) != NULL)
-	{
-		return 1; // successfully open
-	}
-	else
-	{
-		return 0; // fail
-	}
-	//因為我們一次只會開一個file，並且會用FileSystem中的curFile這個指標記住，因此fileID沒有實際用處，就回傳0, 1表示有無成功即可
+	// return the file's id in this program's open file table, -1 on failure
+	OpenFile *file = kernel->fileSystem->Open(name);
+	OpenFileId id;
+
+	if (file == NULL)
+		return -1;
+	id = kernel->currentThread->space->AddFile(file);
+	if (id < 0)
+		delete file; // too many open files
+	return id;
 }
 
 int SysWrite(char *buffer, int size, OpenFileId fileID)
 {
-	return kernel->fileSystem->curFile->Write(buffer, size);
+	OpenFile *file = kernel->currentThread->space->GetFile(fileID);
+
+	if (file == NULL)
+		return -1;
+	return file->Write(buffer, size);
 }
 
 int SysRead(char *buffer, int size, OpenFileId fileID)
 {
-	return kernel->fileSystem->curFile->Read(buffer, size);
+	OpenFile *file = kernel->currentThread->space->GetFile(fileID);
+
+	if (file == NULL)
+		return -1;
+	return file->Read(buffer, size);
 }
 
 int SysClose(OpenFileId id)
 {
-	delete kernel->fileSystem->curFile;
-	kernel->fileSystem->curFile = NULL;
-	return 1;
+	// return 1: success -1: no such file, or buffered writes did not fit
+#ifndef FILESYS_STUB
+	OpenFile *file = kernel->currentThread->space->GetFile(id);
+
+	if (file != NULL && !file->Flush())
+	{ // disk 滿了，寫不進去；檔案還是關掉
+		kernel->currentThread->space->CloseFile(id);
+		return -1;
+	}
+#endif
+	return kernel->currentThread->space->CloseFile(id) ? 1 : -1;
+}
+
+#ifndef FILESYS_STUB
+int SysRemove(char *name)
+{
+	// return 1: success -1: no such file
+	return kernel->fileSystem->Remove(name, FALSE) ? 1 : -1;
+}
+
+void SysSync()
+{
+	OpenFile::FlushAll();        // writes buffered by open files
+	kernel->inodeTable->Flush(); // changed headers of open files
+	kernel->synchDisk->Flush();
 }
 
+int SysFsync(OpenFileId id)
+{
+	// return 1: success -1: no such file, or buffered writes did not fit
+	// 只寫這個檔案的資料，但 cache 整個寫回
+	OpenFile *file = kernel->currentThread->space->GetFile(id);
+
+	if (file == NULL)
+		return -1;
+	bool flushed = file->Flush();
+	kernel->inodeTable->Flush();
+	kernel->synchDisk->Flush();
+	return flushed ? 1 : -1;
+}
+#endif
+
 #endif /* ! __USERPROG_KSYSCALL_H__ */
@@ -34,6 +34,8 @@
 #define SC_ExecV	13
 #define SC_ThreadExit   14
 #define SC_ThreadJoin   15
+#define SC_Sync		16
+#define SC_Fsync	17
 #define SC_Add		42
 #define SC_MSG		100
 
@@ -118,7 +120,9 @@ typedef int OpenFileId;
 // int Create(char *name); // FILESYS_STUB
 int Create(char *name, int size); // FILE_SYS
 
-/* Remove a Nachos file, with name "name" */
+/* Remove a Nachos file, with name "name".
+ * Return 1 on success, negative error code on failure
+ */
 int Remove(char *name);
 
 /* Open the Nachos file "name", and return an "OpenFileId" that can 
@@ -150,6 +154,18 @@ int Seek(int position, OpenFileId id);
  */
 int Close(OpenFileId id);
 
+/* Write everything the file system holds in memory to the disk.  Updates
+ * other threads are in the middle of are waited for and written too.
+ */
+void Sync();
+
+/* Write what is held in memory for the file "id" to the disk; once it
+ * returns, what was written to the file survives a crash.  Like Sync, it
+ * waits for updates other threads are in the middle of.
+ * Return 1 on success, negative error code on failure
+ */
+int Fsync(OpenFileId id);
+
 
 /* User-level thread operations: Fork and Yield.  To allow multiple
  * threads to run within a user program. 